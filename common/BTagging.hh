@@ -0,0 +1,62 @@
+// -*- C++ -*-
+#ifndef TTTT_BTAGGING_HH
+#define TTTT_BTAGGING_HH
+
+#include "Rivet/Jet.hh"
+#include "Rivet/Tools/Cuts.hh"
+#include "TagMask.hh"
+
+namespace Rivet {
+
+  /// The tagged jets of a collection.
+  inline Jets taggedJets(const Jets& jets, TagMask m) {
+    Jets bjets;
+    for (size_t i = 0; i < jets.size(); i++)
+      if (isTagged(m, i))
+        bjets.push_back(jets[i]);
+
+    return bjets;
+  }
+
+
+  /// @brief Ghost-association b-tagging with a cut built once
+  ///
+  /// mask() runs the tag-list scan once per jet; everything downstream
+  /// should work with the resulting TagMask instead of calling bTagged
+  /// again.
+  class BTagger {
+  public:
+
+    BTagger()
+      : _cut(Cuts::open()) { }
+
+    BTagger(const Cut& bhadroncut)
+      : _cut(bhadroncut) { }
+
+    bool tagged(const Jet& j) const {
+      return j.bTagged(_cut);
+    }
+
+    TagMask mask(const Jets& jets) const {
+      TagMask m = 0;
+      for (size_t i = 0; i < jets.size() && i < MAXTAGJETS; i++)
+        if (tagged(jets[i]))
+          m |= TagMask(1) << i;
+
+      return m;
+    }
+
+    const Cut& cut() const {
+      return _cut;
+    }
+
+
+  private:
+
+    Cut _cut;
+
+  };
+
+}
+
+#endif
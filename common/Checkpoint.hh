@@ -0,0 +1,324 @@
+// -*- C++ -*-
+#ifndef TTTT_CHECKPOINT_HH
+#define TTTT_CHECKPOINT_HH
+
+#include "Rivet/Tools/Logging.hh"
+#include "YODA/Histo1D.h"
+#include "YODA/Histo2D.h"
+#include "Config.hh"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+namespace Rivet {
+
+  /// @brief Periodic binary snapshots of raw histogram accumulators
+  ///
+  /// Registered histograms are serialised, unscaled, together with the
+  /// event count and sum of weights every @c checkpoint_every events.  The
+  /// snapshot is taken in the event loop (a flat copy of the bin sums) and
+  /// written to disk on a background thread; the file is replaced
+  /// atomically, so a crash mid-write leaves the previous checkpoint intact.
+  ///
+  /// With @c resume = 1 the histograms and counters are restored in init
+  /// and the events already accounted for are skipped.  This assumes the
+  /// job is rerun over the same, identically ordered input.
+  ///
+  /// Since Rivet's own sumOfWeights() does not survive a restart, the
+  /// analyses normalise with Checkpoint::sumOfWeights() instead.
+  ///
+  /// Histo1D under- and overflows are saved.  Histo2D outflows are not:
+  /// the YODA 1 Histo2D interface has no accessors for them, so after a
+  /// resume they only hold the events since the restart.  The 2D bins and
+  /// total distribution are complete.
+  class Checkpoint {
+  public:
+
+    Checkpoint()
+      : _every(0), _nevt(0), _nseen(0), _nskip(0), _lastwrite(0),
+        _sumw(0), _sumw2(0), _resume(false), _failed(false) { }
+
+    ~Checkpoint() {
+      wait();
+    }
+
+    /// Read checkpoint_every, checkpoint_file and resume from @a cfg.
+    void configure(const ConfigFile& cfg, const string& defname) {
+      _every = cfg.get<size_t>("checkpoint_every", 0);
+      _fname = cfg.has("checkpoint_file") ? cfg.getAll("checkpoint_file").back() : defname + ".ckpt";
+      _resume = cfg.get<int>("resume", 0);
+      return;
+    }
+
+    void add(YODA::Histo1DPtr h) {
+      _h1ds.push_back(h);
+    }
+
+    void add(YODA::Histo2DPtr h) {
+      _h2ds.push_back(h);
+    }
+
+    /// Restore all registered histograms, if resuming was requested.
+    ///
+    /// Must be called after every histogram has been added.
+    void restore() {
+      if (!_resume)
+        return;
+
+      std::ifstream in(_fname.c_str(), std::ios::binary);
+      if (!in) {
+        getLog() << Log::WARN << "no checkpoint " << _fname << " to resume from" << endl;
+        return;
+      }
+
+      string buf((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+      size_t pos = 0;
+      if (!_unpack(buf, pos)) {
+        getLog() << Log::WARN << "checkpoint " << _fname
+          << " does not match the booked histograms; starting from scratch" << endl;
+        _reset();
+        return;
+      }
+
+      _nskip = _nevt;
+      _lastwrite = _nevt;
+      getLog() << Log::INFO << "resumed from " << _fname << " after "
+        << _nevt << " events" << endl;
+      return;
+    }
+
+    /// Count an event and checkpoint if due.
+    ///
+    /// Returns false for events that were already processed before the
+    /// restart; the caller should skip those.
+    bool accept(double weight) {
+      if (_nseen++ < _nskip)
+        return false;
+
+      if (_every && _nevt > _lastwrite && _nevt % _every == 0)
+        write();
+
+      _nevt++;
+      _sumw += weight;
+      _sumw2 += weight*weight;
+      return true;
+    }
+
+    /// Snapshot the current state and write it in the background.
+    void write() {
+      wait();
+
+      string buf;
+      _pack(buf);
+      _lastwrite = _nevt;
+
+      _writer = std::thread(&Checkpoint::_write, this, std::move(buf));
+      return;
+    }
+
+    /// Block until the pending write, if any, has finished.
+    void wait() {
+      if (_writer.joinable())
+        _writer.join();
+
+      if (_failed) {
+        getLog() << Log::WARN << "failed to write checkpoint " << _fname << endl;
+        _failed = false;
+      }
+
+      return;
+    }
+
+    size_t numEvents() const { return _nevt; }
+    double sumOfWeights() const { return _sumw; }
+    double sumOfWeights2() const { return _sumw2; }
+
+
+  private:
+
+    static Log& getLog() {
+      return Log::getLog("Rivet.Checkpoint");
+    }
+
+    /// File layout: magic, version, counters, then per histogram its path
+    /// and the raw Dbn sums of every bin, the total and (1D only) the
+    /// under- and overflow.
+    static const uint32_t MAGIC = 0x4b435454; // "TTCK"
+    static const uint32_t VERSION = 1;
+
+    template<typename T>
+    static void _put(string& buf, const T& x) {
+      buf.append(reinterpret_cast<const char*>(&x), sizeof(T));
+    }
+
+    template<typename T>
+    static bool _get(const string& buf, size_t& pos, T& x) {
+      if (pos + sizeof(T) > buf.size())
+        return false;
+      memcpy(&x, buf.data() + pos, sizeof(T));
+      pos += sizeof(T);
+      return true;
+    }
+
+    static void _put(string& buf, const string& s) {
+      _put(buf, (uint32_t) s.size());
+      buf.append(s);
+    }
+
+    static bool _get(const string& buf, size_t& pos, string& s) {
+      uint32_t n;
+      if (!_get(buf, pos, n) || pos + n > buf.size())
+        return false;
+      s.assign(buf, pos, n);
+      pos += n;
+      return true;
+    }
+
+    static void _put(string& buf, const YODA::Dbn1D& d) {
+      const double xs[5] = { d.numEntries(), d.sumW(), d.sumW2(), d.sumWX(), d.sumWX2() };
+      _put(buf, xs);
+    }
+
+    static bool _get(const string& buf, size_t& pos, YODA::Dbn1D& d) {
+      double xs[5];
+      if (!_get(buf, pos, xs))
+        return false;
+      d = YODA::Dbn1D(xs[0], xs[1], xs[2], xs[3], xs[4]);
+      return true;
+    }
+
+    static void _put(string& buf, const YODA::Dbn2D& d) {
+      const double xs[8] = { d.numEntries(), d.sumW(), d.sumW2(), d.sumWX(), d.sumWX2()
+        , d.sumWY(), d.sumWY2(), d.sumWXY() };
+      _put(buf, xs);
+    }
+
+    static bool _get(const string& buf, size_t& pos, YODA::Dbn2D& d) {
+      double xs[8];
+      if (!_get(buf, pos, xs))
+        return false;
+      d = YODA::Dbn2D(xs[0], xs[1], xs[2], xs[3], xs[4], xs[5], xs[6], xs[7]);
+      return true;
+    }
+
+    void _pack(string& buf) {
+      _put(buf, (uint32_t) MAGIC);
+      _put(buf, (uint32_t) VERSION);
+      _put(buf, (uint64_t) _nevt);
+      _put(buf, _sumw);
+      _put(buf, _sumw2);
+
+      _put(buf, (uint32_t) _h1ds.size());
+      for (const YODA::Histo1DPtr& h : _h1ds) {
+        _put(buf, h->path());
+        _put(buf, (uint32_t) h->numBins());
+        for (const YODA::HistoBin1D& b : h->bins())
+          _put(buf, b.dbn());
+        _put(buf, h->totalDbn());
+        _put(buf, h->underflow());
+        _put(buf, h->overflow());
+      }
+
+      _put(buf, (uint32_t) _h2ds.size());
+      for (const YODA::Histo2DPtr& h : _h2ds) {
+        _put(buf, h->path());
+        _put(buf, (uint32_t) h->numBins());
+        for (const YODA::HistoBin2D& b : h->bins())
+          _put(buf, b.dbn());
+        _put(buf, h->totalDbn());
+      }
+
+      return;
+    }
+
+    bool _unpack(const string& buf, size_t& pos) {
+      uint32_t magic, version, n;
+      uint64_t nevt;
+      string path;
+
+      if (!_get(buf, pos, magic) || magic != MAGIC)
+        return false;
+      if (!_get(buf, pos, version) || version != VERSION)
+        return false;
+      if (!_get(buf, pos, nevt) || !_get(buf, pos, _sumw) || !_get(buf, pos, _sumw2))
+        return false;
+      _nevt = nevt;
+
+      if (!_get(buf, pos, n) || n != _h1ds.size())
+        return false;
+      for (YODA::Histo1DPtr& h : _h1ds) {
+        if (!_get(buf, pos, path) || path != h->path())
+          return false;
+        if (!_get(buf, pos, n) || n != h->numBins())
+          return false;
+        for (YODA::HistoBin1D& b : h->bins())
+          if (!_get(buf, pos, b.dbn()))
+            return false;
+        if (!_get(buf, pos, h->totalDbn()) || !_get(buf, pos, h->underflow()) || !_get(buf, pos, h->overflow()))
+          return false;
+      }
+
+      if (!_get(buf, pos, n) || n != _h2ds.size())
+        return false;
+      for (YODA::Histo2DPtr& h : _h2ds) {
+        if (!_get(buf, pos, path) || path != h->path())
+          return false;
+        if (!_get(buf, pos, n) || n != h->numBins())
+          return false;
+        for (YODA::HistoBin2D& b : h->bins())
+          if (!_get(buf, pos, b.dbn()))
+            return false;
+        if (!_get(buf, pos, h->totalDbn()))
+          return false;
+      }
+
+      return pos == buf.size();
+    }
+
+    void _reset() {
+      for (YODA::Histo1DPtr& h : _h1ds)
+        h->reset();
+      for (YODA::Histo2DPtr& h : _h2ds)
+        h->reset();
+
+      _nevt = 0;
+      _sumw = _sumw2 = 0;
+      return;
+    }
+
+    // runs on the writer thread: only touches its own buffer and _fname.
+    void _write(string buf) {
+      const string tmp = _fname + ".tmp";
+      {
+        std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+        out.write(buf.data(), buf.size());
+        if (!out) {
+          _failed = true;
+          return;
+        }
+      }
+
+      if (std::rename(tmp.c_str(), _fname.c_str()) != 0)
+        _failed = true;
+
+      return;
+    }
+
+    size_t _every, _nevt, _nseen, _nskip, _lastwrite;
+    double _sumw, _sumw2;
+    bool _resume;
+    string _fname;
+
+    vector<YODA::Histo1DPtr> _h1ds;
+    vector<YODA::Histo2DPtr> _h2ds;
+
+    std::thread _writer;
+    std::atomic<bool> _failed;
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,86 @@
+// -*- C++ -*-
+#ifndef TTTT_CONFIG_HH
+#define TTTT_CONFIG_HH
+
+#include "Rivet/Tools/Utils.hh"
+#include "Rivet/Exceptions.hh"
+#include <cstdlib>
+#include <fstream>
+#include <map>
+
+namespace Rivet {
+
+  /// @brief Minimal "key = value" run configuration
+  ///
+  /// Blank lines and everything after a '#' are ignored.  Keys may be
+  /// repeated: getAll returns every value in file order, get the last one.
+  class ConfigFile {
+  public:
+
+    ConfigFile() { }
+
+    /// Read the file named by the environment variable @a envvar, if it is set.
+    static ConfigFile fromEnv(const string& envvar) {
+      ConfigFile cfg;
+      const char* fname = getenv(envvar.c_str());
+      if (fname && *fname)
+        cfg.read(fname);
+      return cfg;
+    }
+
+    void read(const string& fname) {
+      std::ifstream in(fname.c_str());
+      if (!in)
+        throw UserError("cannot open configuration file " + fname);
+
+      string line;
+      while (getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+
+        size_t eq = line.find('=');
+        if (eq == string::npos) {
+          if (!strip(line).empty())
+            throw UserError("malformed line in " + fname + ": " + line);
+          continue;
+        }
+
+        _entries[strip(line.substr(0, eq))].push_back(strip(line.substr(eq+1)));
+      }
+
+      return;
+    }
+
+    bool has(const string& key) const {
+      return _entries.count(key);
+    }
+
+    const vector<string>& getAll(const string& key) const {
+      static const vector<string> empty;
+      std::map<string, vector<string> >::const_iterator it = _entries.find(key);
+      return it == _entries.end() ? empty : it->second;
+    }
+
+    template<typename T>
+    T get(const string& key, const T& def) const {
+      const vector<string>& vs = getAll(key);
+      return vs.empty() ? def : lexical_cast<T>(vs.back());
+    }
+
+
+  private:
+
+    static string strip(const string& s) {
+      const char* ws = " \t\r";
+      size_t b = s.find_first_not_of(ws);
+      if (b == string::npos)
+        return "";
+      return s.substr(b, s.find_last_not_of(ws) - b + 1);
+    }
+
+    std::map<string, vector<string> > _entries;
+
+  };
+
+}
+
+#endif
@@ -0,0 +1,68 @@
+// -*- C++ -*-
+#ifndef TTTT_NORMALISATION_HH
+#define TTTT_NORMALISATION_HH
+
+// only depends on YODA, so that ttttmerge can share it with TTTT::finalize.
+#include "YODA/Histo1D.h"
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+
+namespace Rivet {
+
+  // from https://stackoverflow.com/questions/3418231/replace-part-of-a-string-with-another-string
+  inline std::string replace(const std::string& str, const std::string& from, const std::string& to) {
+    std::string ret = str;
+    size_t start_pos = str.find(from);
+    if(start_pos == std::string::npos)
+      return ret;
+    ret.replace(start_pos, from.length(), to);
+    return ret;
+  }
+
+
+  /// Annotations recording how a histogram was scaled, so that job
+  /// outputs can be turned back into raw sums of weights.
+  const std::string sumwkey = "SumW";
+  const std::string xseckey = "CrossSection";
+
+
+  /// Record sumw and the cross section on @a h and scale it to xsec/sumw.
+  inline void scaleToCrossSection(YODA::Histo1D& h, double xsec, double sumw) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.17g", sumw);
+    h.setAnnotation(sumwkey, buf);
+    snprintf(buf, sizeof(buf), "%.17g", xsec);
+    h.setAnnotation(xseckey, buf);
+
+    // like Rivet's Analysis::scale: a job without any events would
+    // otherwise write NaNs.
+    double factor = xsec/sumw;
+    if (!std::isfinite(factor)) {
+      std::cerr << "warning: cannot scale " << h.path() << " by " << xsec
+        << "/" << sumw << "; scaling by 0 instead" << std::endl;
+      factor = 0;
+    }
+
+    h.scaleW(factor);
+    return;
+  }
+
+
+  /// Unit-normalised "_norm" copy of @a h with a 1/sigma y label.
+  inline std::shared_ptr<YODA::Histo1D> normalisedCopy(const YODA::Histo1D& h) {
+    const std::string onebysig = "\\ensuremath{\\frac{1}{\\sigma}}";
+
+    std::shared_ptr<YODA::Histo1D> hnorm = std::make_shared<YODA::Histo1D>(h);
+    if (hnorm->integral() != 0)
+      hnorm->normalize();
+    hnorm->setPath(hnorm->path() + "_norm");
+    hnorm->setAnnotation("YLabel", onebysig + replace(hnorm->annotation("YLabel"), "pb", "1"));
+    return hnorm;
+  }
+
+}
+
+#endif
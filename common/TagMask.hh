@@ -0,0 +1,39 @@
+// -*- C++ -*-
+#ifndef TTTT_TAGMASK_HH
+#define TTTT_TAGMASK_HH
+
+// kept free of Rivet so that the reconstruction kernels can use it.
+#include <cstddef>
+#include <cstdint>
+
+namespace Rivet {
+
+  /// One bit per jet, bit i set if jet i of a collection is b-tagged.
+  typedef uint64_t TagMask;
+
+  /// Jets past this index are never reported as tagged.
+  const size_t MAXTAGJETS = 64;
+
+  inline bool isTagged(TagMask m, size_t i) {
+    return i < MAXTAGJETS && ((m >> i) & 1);
+  }
+
+  inline size_t countTags(TagMask m) {
+    return __builtin_popcountll(m);
+  }
+
+  /// Mask of the first @a n jets.
+  inline TagMask firstJets(size_t n) {
+    return n >= MAXTAGJETS ? ~TagMask(0) : (TagMask(1) << n) - 1;
+  }
+
+  /// The mask of a collection with jet @a i removed.
+  inline TagMask dropJet(TagMask m, size_t i) {
+    if (i >= MAXTAGJETS)
+      return m;
+    return (m & firstJets(i)) | ((m >> 1) & ~firstJets(i));
+  }
+
+}
+
+#endif
@@ -0,0 +1,134 @@
+// -*- C++ -*-
+#ifndef TTTT_TOPOBJECTS_HH
+#define TTTT_TOPOBJECTS_HH
+
+#include "Rivet/Projection.hh"
+#include "Rivet/Projections/FinalState.hh"
+#include "Rivet/Projections/PromptFinalState.hh"
+#include "Rivet/Projections/ChargedLeptons.hh"
+#include "Rivet/Projections/VetoedFinalState.hh"
+#include "Rivet/Projections/FastJets.hh"
+#include "BTagging.hh"
+
+namespace Rivet {
+
+  /// @brief The prompt-lepton and anti-kT R=0.4 jet stack of TTTT and HadTop
+  ///
+  /// Both analyses declare this projection.  Rivet keeps a single
+  /// registered instance of equivalent projections and applies it once per
+  /// event, so when both plugins run in the same job the jets are clustered
+  /// and b-tagged only once and the second analysis gets the cached result.
+  /// numProjections() counts the project() calls of all instances;
+  /// tools/check-shared-projection.sh runs both plugins on a sample and
+  /// checks that it is one per event.
+  ///
+  /// Jets of any other radius should be made with antiKtJets(R), so that
+  /// they are clustered from the same inputs.
+  class TopObjects : public Projection {
+  public:
+
+    TopObjects() {
+      setName("TopObjects");
+
+      declare(promptLeptons(), "PromptLeptons");
+      declare(jetInputs(), "JetInputs");
+      declare(antiKtJets(0.4), "Jets");
+
+      _jetcut = Cuts::pT > 25*GeV;
+
+      // only can tag b-hadrons in the tracker fiducial volume.
+      _btagger = BTagger(Cuts::pT > 5*GeV && Cuts::abseta < 2.5);
+    }
+
+    DEFAULT_RIVET_PROJ_CLONE(TopObjects);
+
+
+    static PromptFinalState promptLeptons() {
+      return PromptFinalState(ChargedLeptons(Cuts::abseta < 2.5 && Cuts::pT > 25*GeV), true);
+    }
+
+    /// All stable particles that aren't invisible and aren't prompt leptons.
+    static VetoedFinalState jetInputs() {
+      VetoedFinalState vfs(FinalState(Cuts::abseta < 5.0 && Cuts::pT > 100*MeV));
+      vfs.addVetoOnThisFinalState(promptLeptons());
+      return vfs;
+    }
+
+    static FastJets antiKtJets(double R) {
+      return FastJets(jetInputs(), FastJets::ANTIKT, R);
+    }
+
+
+    const Particles& leptons() const {
+      return _leptons;
+    }
+
+    /// Jets with pT > 25 GeV, by decreasing pT.
+    const Jets& jets() const {
+      return _jets;
+    }
+
+    /// The b-tags of jets().
+    TagMask bmask() const {
+      return _bmask;
+    }
+
+    /// Any R=0.4 jets, by decreasing pT.
+    Jets jetsByPt(const Cut& c) const {
+      Jets js;
+      for (const Jet& j : _alljets)
+        if (c->accept(j))
+          js.push_back(j);
+
+      return js;
+    }
+
+    const BTagger& btagger() const {
+      return _btagger;
+    }
+
+    /// Number of project() calls of any TopObjects in this library, i.e.
+    /// of R=0.4 clusterings and b-taggings.  Plugins in separate libraries
+    /// each have their own count.
+    static size_t numProjections() {
+      return _nprojections();
+    }
+
+
+  protected:
+
+    void project(const Event& e) {
+      MSG_DEBUG("projecting");
+      _nprojections()++;
+
+      _leptons = apply<PromptFinalState>(e, "PromptLeptons").particles();
+      _alljets = apply<FastJets>(e, "Jets").jetsByPt();
+      _jets = jetsByPt(_jetcut);
+      _bmask = _btagger.mask(_jets);
+      return;
+    }
+
+    int compare(const Projection& p) const {
+      return mkNamedPCmp(p, "Jets") || mkNamedPCmp(p, "PromptLeptons");
+    }
+
+
+  private:
+
+    static size_t& _nprojections() {
+      static size_t n = 0;
+      return n;
+    }
+
+    Cut _jetcut;
+    BTagger _btagger;
+
+    Particles _leptons;
+    Jets _alljets, _jets;
+    TagMask _bmask;
+
+  };
+
+}
+
+#endif
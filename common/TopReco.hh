@@ -0,0 +1,342 @@
+// -*- C++ -*-
+#ifndef TTTT_TOPRECO_HH
+#define TTTT_TOPRECO_HH
+
+// The TTTT reconstruction kernels on plain four-vector arrays.
+//
+// Nothing here depends on Rivet, so the same code backs both the TTTT
+// analysis (which converts its Jets on the way in) and the ttttreco Python
+// extension (which hands over NumPy buffers without copying).  All
+// energies and masses are in GeV.
+
+#include "YODA/Histo2D.h"
+#include "TagMask.hh"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace Rivet {
+
+  /// A jet four-momentum laid out as (px, py, pz, E), matching one row
+  /// of an (n, 4) float64 array.
+  struct JetP4 {
+    double px, py, pz, e;
+
+    JetP4& operator+=(const JetP4& o) {
+      px += o.px; py += o.py; pz += o.pz; e += o.e;
+      return *this;
+    }
+
+    JetP4 operator+(const JetP4& o) const {
+      JetP4 r = *this;
+      return r += o;
+    }
+
+    double pt() const {
+      return std::sqrt(px*px + py*py);
+    }
+
+    /// signed, like FourMomentum::mass
+    double mass() const {
+      const double m2 = e*e - px*px - py*py - pz*pz;
+      return m2 < 0 ? -std::sqrt(-m2) : std::sqrt(m2);
+    }
+
+    double eta() const {
+      return std::asinh(pz / pt());
+    }
+
+    double phi() const {
+      return std::atan2(py, px);
+    }
+  };
+
+  static_assert(sizeof(JetP4) == 4*sizeof(double), "JetP4 must alias an (n, 4) double array");
+
+  inline double deltaR(const JetP4& a, const JetP4& b) {
+    const double deta = a.eta() - b.eta();
+    double dphi = std::fabs(a.phi() - b.phi());
+    if (dphi > M_PI)
+      dphi = 2*M_PI - dphi;
+    return std::sqrt(deta*deta + dphi*dphi);
+  }
+
+
+  /// @brief Top-tagging template: a HadTop ttPDF histogram on a regular grid
+  ///
+  /// lookup(x, y) is the bin volume at (x, y), or 0 outside the histogram.
+  ///
+  /// This differs from the Histo2D::binAt lookup it replaces, which threw
+  /// a RangeError outside the binning and so ended the run: a candidate
+  /// with a (mass, njets) point off the template, e.g. a slightly negative
+  /// mass or one beyond a HadTop configuration's mmax, now gets
+  /// probability 0, and ttProb moves on to the other assignments.
+  class TopTemplate {
+  public:
+
+    TopTemplate() { }
+
+    explicit TopTemplate(const YODA::Histo2D& h) {
+      for (const YODA::HistoBin2D& b : h.bins()) {
+        _xedges.push_back(b.xMin());
+        _xedges.push_back(b.xMax());
+        _yedges.push_back(b.yMin());
+        _yedges.push_back(b.yMax());
+      }
+
+      _unique(_xedges);
+      _unique(_yedges);
+
+      _volumes.assign(nx()*ny(), 0);
+      for (const YODA::HistoBin2D& b : h.bins())
+        _volumes[_index(b.xMid(), b.yMid())] = b.volume();
+    }
+
+    bool empty() const {
+      return _volumes.empty();
+    }
+
+    double lookup(double x, double y) const {
+      if (empty() || x < _xedges.front() || x >= _xedges.back()
+          || y < _yedges.front() || y >= _yedges.back())
+        return 0;
+
+      return _volumes[_index(x, y)];
+    }
+
+
+  private:
+
+    size_t nx() const { return _xedges.size() - 1; }
+    size_t ny() const { return _yedges.size() - 1; }
+
+    size_t _index(double x, double y) const {
+      const size_t ix = std::upper_bound(_xedges.begin(), _xedges.end(), x) - _xedges.begin() - 1;
+      const size_t iy = std::upper_bound(_yedges.begin(), _yedges.end(), y) - _yedges.begin() - 1;
+      return ix*ny() + iy;
+    }
+
+    static void _unique(std::vector<double>& v) {
+      std::sort(v.begin(), v.end());
+      v.erase(std::unique(v.begin(), v.end()), v.end());
+    }
+
+    std::vector<double> _xedges, _yedges, _volumes;
+
+  };
+
+
+  /// Probability of @a nj jets with @a nb b-tags and total momentum
+  /// @a alljets coming from one hadronic top.
+  inline double topProb(const TopTemplate& topPDF0b, const TopTemplate& topPDF1b
+      , const JetP4& alljets, size_t nj, size_t nb) {
+    if (nj != 2 && nj != 3)
+      return 0.0;
+
+    double mass = alljets.mass();
+    if (nb > 1 || mass > 400)
+      return 0.0;
+
+    if (nb)
+      return topPDF1b.lookup(mass, nj + 0.1);
+    else
+      return topPDF0b.lookup(mass, nj + 0.1);
+  }
+
+
+  /// Best two-hadronic-top probability over all assignments of 2 or 3 of
+  /// the first eight jets to each top.
+  inline double ttProb(const TopTemplate& topPDF0b, const TopTemplate& topPDF1b
+      , const JetP4* jets, size_t nj, TagMask bmask) {
+    if (nj < 4)
+      return 0.0;
+
+    // only look at the first 8 jets for now.
+    // the permutations run over jet indices; b-tags are bit tests.
+    size_t n = std::min(nj, (size_t) 8);
+    size_t idx[8];
+    for (size_t i = 0; i < n; i++)
+      idx[i] = i;
+
+    // mass and b-tag count of the top candidate made of the jets at
+    // permutation positions [first, first+len).
+    auto candProb = [&](size_t first, size_t len) {
+      JetP4 sum = { 0, 0, 0, 0 };
+      size_t nb = 0;
+      for (size_t k = first; k < first+len; k++) {
+        sum += jets[idx[k]];
+        nb += isTagged(bmask, idx[k]);
+      }
+
+      return topProb(topPDF0b, topPDF1b, sum, len, nb);
+    };
+
+    double bestprob = 1e-50;
+    do {
+      double prob;
+
+      prob = candProb(0, 2) * candProb(2, 2);
+      if (prob > bestprob)
+        bestprob = prob;
+
+
+      if (nj < 5)
+        continue;
+
+      prob = candProb(0, 2) * candProb(2, 3);
+      if (prob > bestprob)
+        bestprob = prob;
+
+      prob = candProb(0, 3) * candProb(3, 2);
+      if (prob > bestprob)
+        bestprob = prob;
+
+
+      if (nj < 6)
+        continue;
+
+      prob = candProb(0, 3) * candProb(3, 3);
+      if (prob > bestprob)
+        bestprob = prob;
+
+    } while (std::next_permutation(idx, idx+n));
+
+    return bestprob;
+  }
+
+
+  // default W and top mass hypothesis for chi2_hadhad [GeV]
+  const double default_mw = 80.51;
+  const double default_mt_mw = 85.17;
+  const double default_sigw = 12.07;
+  const double default_sig_mt_mw = 16.05;
+
+  /// @brief A set of (m_W, m_t - m_W) hypotheses sharing the resolutions
+  ///
+  /// Stored column-wise so that the loops over hypotheses in chi2_hadhad
+  /// vectorise.
+  struct MassHypotheses {
+    std::vector<double> mw, mt_mw;
+    double sigw, sig_mt_mw;
+
+    MassHypotheses()
+      : sigw(default_sigw), sig_mt_mw(default_sig_mt_mw) { }
+
+    void add(double m_w, double m_t_mw) {
+      mw.push_back(m_w);
+      mt_mw.push_back(m_t_mw);
+    }
+
+    size_t size() const {
+      return mw.size();
+    }
+  };
+
+  /// @brief Minimum chi2 of the hadronic tt assignment for every hypothesis
+  ///
+  /// The jet combinatorics are independent of the hypotheses: every
+  /// (W jet pair, b jet) triplet among the first eight jets is built once,
+  /// its W and top terms are evaluated for all hypotheses at a time, and
+  /// the minimum is taken over all pairs of disjoint triplets.
+  inline void chi2_hadhad(const JetP4* jets, size_t nj, const MassHypotheses& hyps
+      , std::vector<double>& minchi2) {
+    const size_t nh = hyps.size();
+    minchi2.assign(nh, 1e9);
+    if (nj < 6)
+      return;
+
+    // TODO
+    // only look at up to the first eight jets for now...
+    const size_t n = std::min(nj, (size_t) 8);
+
+    // top candidates: W from jets a < b, b quark from jet c.
+    std::vector<uint8_t> used;
+    std::vector<double> mjj, mjjj;
+    for (size_t a = 0; a < n; a++) {
+      for (size_t b = a+1; b < n; b++) {
+        const JetP4 wmom = jets[a] + jets[b];
+        for (size_t c = 0; c < n; c++) {
+          if (c == a || c == b)
+            continue;
+
+          used.push_back((1 << a) | (1 << b) | (1 << c));
+          mjj.push_back(wmom.mass());
+          mjjj.push_back((wmom + jets[c]).mass());
+        }
+      }
+    }
+
+    const size_t nt = used.size();
+    const double* mw = hyps.mw.data();
+    const double* mt_mw = hyps.mt_mw.data();
+    const double invsigw = 1 / hyps.sigw;
+    const double invsigt = 1 / hyps.sig_mt_mw;
+
+    // terms[t*nh + h]: chi2 contribution of candidate t under hypothesis h
+    std::vector<double> terms(nt*nh);
+    for (size_t t = 0; t < nt; t++) {
+      double* term = &terms[t*nh];
+      for (size_t h = 0; h < nh; h++) {
+        const double wterm = (mjj[t] - mw[h]) * invsigw;
+        const double tterm = (mjjj[t] - mt_mw[h]) * invsigt;
+        term[h] = wterm*wterm + tterm*tterm;
+      }
+    }
+
+    double* best = minchi2.data();
+    for (size_t t1 = 0; t1 < nt; t1++) {
+      const double* term1 = &terms[t1*nh];
+      for (size_t t2 = t1+1; t2 < nt; t2++) {
+        if (used[t1] & used[t2])
+          continue;
+
+        const double* term2 = &terms[t2*nh];
+        for (size_t h = 0; h < nh; h++)
+          best[h] = std::min(best[h], term1[h] + term2[h]);
+      }
+    }
+
+    return;
+  }
+
+
+  /// @brief The jets not overlapping with any top jet
+  ///
+  /// Jets below 60 GeV are always kept, since they are likely to come from
+  /// the spectators; harder ones are dropped within dR < 1.2 of a top jet.
+  /// The indices of the kept jets are appended to @a keep, and @a addmask
+  /// receives their b-tags taken from @a jetsmask.
+  inline void additionalJets(const JetP4* jets, size_t nj, TagMask jetsmask
+      , const JetP4* topjets, size_t ntop
+      , std::vector<size_t>& keep, TagMask& addmask) {
+    addmask = 0;
+    size_t nkept = 0;
+
+    for (size_t i = 0; i < nj; i++) {
+      bool pass = true;
+
+      if (jets[i].pt() >= 60) {
+        for (size_t t = 0; t < ntop; t++) {
+          if (deltaR(topjets[t], jets[i]) > 1.2)
+            continue;
+
+          pass = false;
+          break;
+        }
+      }
+
+      if (!pass)
+        continue;
+
+      if (isTagged(jetsmask, i) && nkept < MAXTAGJETS)
+        addmask |= TagMask(1) << nkept;
+      keep.push_back(i);
+      nkept++;
+    }
+
+    return;
+  }
+
+}
+
+#endif
@@ -0,0 +1,203 @@
+// -*- C++ -*-
+#ifndef TTTT_TRUTHINDEX_HH
+#define TTTT_TRUTHINDEX_HH
+
+#include "Rivet/Projection.hh"
+#include "Rivet/Event.hh"
+#include <array>
+
+namespace Rivet {
+
+  /// @brief Per-event PID index of the hard process and the top decay chains
+  ///
+  /// The generator record is not scanned in full: the walk starts at the
+  /// signal-process vertex (or the first hard-process particle in record
+  /// order, which is within the first few entries for PYTHIA and HERWIG),
+  /// follows the vertices connected through hard-process particles, and
+  /// from every top its copies and the t -> W b -> ... decays.  Shower and
+  /// hadronisation entries are never visited, and tops not connected to
+  /// the hard process (e.g. from gluon splitting) are not indexed.  Records
+  /// without any hard-process marking fall back to a full scan for tops,
+  /// with a warning.
+  ///
+  /// Raw HepMC pointers are used throughout (no Particle wrappers), bucketed
+  /// by |PID| so that tops, W bosons and b quarks can be looked up directly.
+  /// The buckets keep their capacity between events, so steady-state
+  /// running does not allocate.
+  class TruthIndex : public Projection {
+  public:
+
+    typedef vector<const GenParticle*> GenParticlePtrs;
+
+    /// Largest |PID| that gets indexed (quarks, leptons and SM bosons).
+    static const size_t MAXPID = 25;
+
+    TruthIndex()
+      : _warned(false) {
+      setName("TruthIndex");
+    }
+
+    DEFAULT_RIVET_PROJ_CLONE(TruthIndex);
+
+
+    /// All indexed particles with the given |PID|, in the order the walk
+    /// reaches them: hard-process vertices first, then each top's copies
+    /// and decays.
+    const GenParticlePtrs& byAbsPid(int apid) const {
+      static const GenParticlePtrs empty;
+      if (apid < 0 || (size_t) apid > MAXPID)
+        return empty;
+      return _index[apid];
+    }
+
+    /// The first indexed particle with the given |PID|, or NULL.
+    const GenParticle* first(int apid) const {
+      const GenParticlePtrs& ps = byAbsPid(apid);
+      return ps.empty() ? NULL : ps.front();
+    }
+
+    const GenParticlePtrs& tops() const { return byAbsPid(6); }
+    const GenParticlePtrs& Ws() const { return byAbsPid(24); }
+    const GenParticlePtrs& bs() const { return byAbsPid(5); }
+
+
+  protected:
+
+    void project(const Event& e) {
+      for (GenParticlePtrs& ps : _index)
+        ps.clear();
+      _vertices.clear();
+
+      const GenEvent* ge = e.genEvent();
+      const GenVertex* sv = ge->signal_process_vertex();
+      if (sv) {
+        _addHardProcess(sv);
+        return;
+      }
+
+      // no signal vertex recorded: the hard process comes first, so this
+      // stops after a handful of entries.
+      for (GenEvent::particle_const_iterator it = ge->particles_begin();
+          it != ge->particles_end(); ++it) {
+        const GenParticle* p = *it;
+        if (!isHardProcess(p->status()))
+          continue;
+
+        if (p->production_vertex())
+          _addHardProcess(p->production_vertex());
+        if (p->end_vertex())
+          _addHardProcess(p->end_vertex());
+        return;
+      }
+
+      // no hard process marked at all: index every top in the record,
+      // as a full scan would.
+      if (!_warned) {
+        MSG_WARNING("no signal-process vertex or hard-process status codes"
+            " in the record; indexing all tops instead");
+        _warned = true;
+      }
+
+      for (GenEvent::particle_const_iterator it = ge->particles_begin();
+          it != ge->particles_end(); ++it) {
+        const GenParticle* p = *it;
+        if (abs(p->pdg_id()) != 6)
+          continue;
+
+        _add(p, 6);
+        _addTopDecay(p);
+      }
+
+      return;
+    }
+
+    int compare(const Projection&) const {
+      return EQUIVALENT;
+    }
+
+
+  private:
+
+    /// Hard-process status codes: 3 (HERWIG/PYTHIA6) or 21-29 (PYTHIA8).
+    static bool isHardProcess(int status) {
+      return status == 3 || (status >= 21 && status <= 29);
+    }
+
+    /// Top and W decay products: quarks, leptons, W bosons.
+    static bool isDecayProduct(int apid) {
+      return apid <= 5 || (apid >= 11 && apid <= 16) || apid == 24;
+    }
+
+    void _add(const GenParticle* p, int apid) {
+      if ((size_t) apid > MAXPID)
+        return;
+
+      GenParticlePtrs& ps = _index[apid];
+      if (std::find(ps.begin(), ps.end(), p) == ps.end())
+        ps.push_back(p);
+    }
+
+    // index the hard-process particles and tops attached to v and walk
+    // on through the other vertex of every hard-process particle.
+    void _addHardProcess(const GenVertex* v) {
+      if (std::find(_vertices.begin(), _vertices.end(), v) != _vertices.end())
+        return;
+      _vertices.push_back(v);
+
+      for (GenVertex::particles_in_const_iterator it = v->particles_in_const_begin();
+          it != v->particles_in_const_end(); ++it)
+        _addHardParticle(*it, (*it)->production_vertex());
+
+      for (GenVertex::particles_out_const_iterator it = v->particles_out_const_begin();
+          it != v->particles_out_const_end(); ++it)
+        _addHardParticle(*it, (*it)->end_vertex());
+
+      return;
+    }
+
+    void _addHardParticle(const GenParticle* p, const GenVertex* next) {
+      const int apid = abs(p->pdg_id());
+
+      if (apid == 6) {
+        _add(p, apid);
+        _addTopDecay(p);
+      } else if (isHardProcess(p->status())) {
+        _add(p, apid);
+        if (next)
+          _addHardProcess(next);
+      }
+
+      return;
+    }
+
+    // follow the top copies, t -> W b and W -> f f'.  only tops and W
+    // bosons (and their copies) are followed further: the quarks shower.
+    void _addTopDecay(const GenParticle* p) {
+      const GenVertex* v = p->end_vertex();
+      if (!v)
+        return;
+
+      for (GenVertex::particles_out_const_iterator it = v->particles_out_const_begin();
+          it != v->particles_out_const_end(); ++it) {
+        const GenParticle* d = *it;
+        const int apid = abs(d->pdg_id());
+        if (apid != 6 && !isDecayProduct(apid))
+          continue;
+
+        _add(d, apid);
+        if (apid == 6 || apid == 24)
+          _addTopDecay(d);
+      }
+
+      return;
+    }
+
+    std::array<GenParticlePtrs, MAXPID+1> _index;
+    vector<const GenVertex*> _vertices;
+    bool _warned;
+
+  };
+
+}
+
+#endif
@@ -1,13 +1,27 @@
 // -*- C++ -*-
 #include "Rivet/Analysis.hh"
-#include "Rivet/Projections/PromptFinalState.hh"
-#include "Rivet/Projections/ChargedLeptons.hh"
-#include "Rivet/Projections/VetoedFinalState.hh"
 #include "Rivet/Projections/FastJets.hh"
+#include "../common/TruthIndex.hh"
+#include "../common/Config.hh"
+#include "../common/Checkpoint.hh"
+#include "../common/BTagging.hh"
+#include "../common/TopObjects.hh"
 
 namespace Rivet {
 
   /// @brief Add a short analysis description here
+  ///
+  /// Several template configurations (jet radius, jet and b-tag cuts, mass
+  /// range) can be filled in one pass: set HADTOP_CONFIG to a file with one
+  ///
+  ///   config = <label> <R> <jet pT min/GeV> <jet |eta| max> <b-hadron pT min/GeV> <mass min/GeV> <mass max/GeV>
+  ///
+  /// line per configuration.  Each one gets its own ttPDF* histograms,
+  /// suffixed with "_<label>"; without a config file the single default
+  /// configuration below is used and the histogram names are unchanged.
+  ///
+  /// The same file takes the checkpoint_every / checkpoint_file / resume
+  /// settings of Checkpoint.
   class HadTop : public Analysis {
   public:
 
@@ -15,34 +29,110 @@ namespace Rivet {
     DEFAULT_RIVET_ANALYSIS_CTOR(HadTop);
 
 
+    /// One set of template cuts and the histograms it fills.
+    struct TemplateConfig {
+      string label;
+      double R, ptmin, etamax, bghostpt, mmin, mmax;
+
+      // FastJets projection name; empty for the R=0.4 jets of TopObjects
+      string jetsname;
+      Cut jetcut;
+      BTagger btagger;
+
+      Histo2DPtr hPDF, hPDF0b, hPDF1b;
+      Histo1DPtr hPDF2j0b, hPDF2j1b, hPDF3j0b, hPDF3j1b, hPDF4j0b, hPDF4j1b;
+    };
+
+
     /// @name Analysis methods
     //@{
 
     /// Book histograms and initialise projections before the run
     void init() {
       // Initialise and register projections
-      PromptFinalState pls(ChargedLeptons(Cuts::abseta < 2.5 && Cuts::pT > 25*GeV), true);
-      declare(pls, "PromptLeptons");
-
-      // build jets out of all stable particles that aren't invisible
-      // and aren't prompt leptons
-      VetoedFinalState vfs(FinalState(Cuts::abseta < 5.0 && Cuts::pT > 100*MeV));
-      vfs.addVetoOnThisFinalState(pls);
-
-      declare(FastJets(vfs, FastJets::ANTIKT, 0.4), "Jets");
-
-      // Book histograms
-      hPDF = bookHisto2D("ttPDF", 50, 0, 400, 5, 0, 5, "ttPDF", "mass", "njets", "probability");
-      hPDF0b = bookHisto2D("ttPDF0b", 50, 0, 400, 5, 0, 5, "ttPDF0b", "mass", "njets", "probability");
-      hPDF1b = bookHisto2D("ttPDF1b", 50, 0, 400, 5, 0, 5, "ttPDF1b", "mass", "njets", "probability");
-      hPDF2j0b = bookHisto1D("ttPDF2j0b", 50, 0, 400, "ttPDF2j0b", "mass", "probability");
-      hPDF2j1b = bookHisto1D("ttPDF2j1b", 50, 0, 400, "ttPDF2j1b", "mass", "probability");
-      hPDF3j0b = bookHisto1D("ttPDF3j0b", 50, 0, 400, "ttPDF3j0b", "mass", "probability");
-      hPDF3j1b = bookHisto1D("ttPDF3j1b", 50, 0, 400, "ttPDF3j1b", "mass", "probability");
-      hPDF4j0b = bookHisto1D("ttPDF4j0b", 50, 0, 400, "ttPDF4j0b", "mass", "probability");
-      hPDF4j1b = bookHisto1D("ttPDF4j1b", 50, 0, 400, "ttPDF4j1b", "mass", "probability");
+
+      // prompt leptons and R=0.4 jets, shared with TTTT
+      declare(TopObjects(), "Objects");
+
+      // hard-process and top-decay truth particles, indexed by |PID|
+      declare(TruthIndex(), "Truth");
+
+      const ConfigFile cfg = ConfigFile::fromEnv("HADTOP_CONFIG");
+      if (cfg.has("config")) {
+        for (const string& line : cfg.getAll("config")) {
+          const TemplateConfig c = parseConfig(line);
+          for (const TemplateConfig& other : configs)
+            if (other.label == c.label)
+              throw UserError("HadTop: duplicate template configuration label " + c.label);
+
+          configs.push_back(c);
+        }
+      } else {
+        TemplateConfig c = { "", 0.4, 25*GeV, 2.5, 5*GeV, 0*GeV, 400*GeV };
+        configs.push_back(c);
+      }
+
+      // one clustering per distinct jet radius, shared by every
+      // configuration that uses it.  R=0.4 comes from TopObjects.
+      map<double, string> jetsnames;
+      jetsnames[0.4] = "";
+      for (TemplateConfig& c : configs) {
+        if (!jetsnames.count(c.R)) {
+          const string name = "Jets" + to_str(jetsnames.size());
+          declare(TopObjects::antiKtJets(c.R), name);
+          jetsnames[c.R] = name;
+        }
+
+        c.jetsname = jetsnames[c.R];
+        c.jetcut = Cuts::pT > c.ptmin && Cuts::abseta < c.etamax;
+        c.btagger = BTagger(Cuts::pT > c.bghostpt);
+        bookConfig(c);
+      }
 
       hTopPtEta = bookHisto2D("TopPtEta", 50, 0, 500*GeV, 50, 0, 5, "TopPtEta", "pt", "eta", "probability");
+      checkpoint.add(hTopPtEta);
+
+      checkpoint.configure(cfg, name());
+      checkpoint.restore();
+
+      return;
+    }
+
+
+    TemplateConfig parseConfig(const string& line) {
+      TemplateConfig c;
+      std::istringstream ss(line);
+      ss >> c.label >> c.R >> c.ptmin >> c.etamax >> c.bghostpt >> c.mmin >> c.mmax;
+      if (!ss)
+        throw UserError("HadTop: malformed template configuration: " + line);
+      if (c.mmax <= c.mmin)
+        throw UserError("HadTop: empty mass range in template configuration: " + line);
+
+      c.ptmin *= GeV;
+      c.bghostpt *= GeV;
+      c.mmin *= GeV;
+      c.mmax *= GeV;
+      return c;
+    }
+
+
+    void bookConfig(TemplateConfig& c) {
+      const string sfx = c.label.empty() ? "" : "_" + c.label;
+
+      c.hPDF = bookHisto2D("ttPDF" + sfx, 50, c.mmin, c.mmax, 5, 0, 5, "ttPDF" + sfx, "mass", "njets", "probability");
+      c.hPDF0b = bookHisto2D("ttPDF0b" + sfx, 50, c.mmin, c.mmax, 5, 0, 5, "ttPDF0b" + sfx, "mass", "njets", "probability");
+      c.hPDF1b = bookHisto2D("ttPDF1b" + sfx, 50, c.mmin, c.mmax, 5, 0, 5, "ttPDF1b" + sfx, "mass", "njets", "probability");
+      c.hPDF2j0b = bookHisto1D("ttPDF2j0b" + sfx, 50, c.mmin, c.mmax, "ttPDF2j0b" + sfx, "mass", "probability");
+      c.hPDF2j1b = bookHisto1D("ttPDF2j1b" + sfx, 50, c.mmin, c.mmax, "ttPDF2j1b" + sfx, "mass", "probability");
+      c.hPDF3j0b = bookHisto1D("ttPDF3j0b" + sfx, 50, c.mmin, c.mmax, "ttPDF3j0b" + sfx, "mass", "probability");
+      c.hPDF3j1b = bookHisto1D("ttPDF3j1b" + sfx, 50, c.mmin, c.mmax, "ttPDF3j1b" + sfx, "mass", "probability");
+      c.hPDF4j0b = bookHisto1D("ttPDF4j0b" + sfx, 50, c.mmin, c.mmax, "ttPDF4j0b" + sfx, "mass", "probability");
+      c.hPDF4j1b = bookHisto1D("ttPDF4j1b" + sfx, 50, c.mmin, c.mmax, "ttPDF4j1b" + sfx, "mass", "probability");
+
+      for (Histo2DPtr h : { c.hPDF, c.hPDF0b, c.hPDF1b })
+        checkpoint.add(h);
+      for (Histo1DPtr h : { c.hPDF2j0b, c.hPDF2j1b, c.hPDF3j0b, c.hPDF3j1b, c.hPDF4j0b, c.hPDF4j1b })
+        checkpoint.add(h);
 
       return;
     }
@@ -50,26 +140,30 @@ namespace Rivet {
 
     /// Perform the per-event analysis
     void analyze(const Event& event) {
-      for (const Particle& t : event.allParticles()) {
-        if (t.abspid() != 6)
-          continue;
-        else {
-          hTopPtEta->fill(t.pt(), t.abseta(), event.weight());
-          break;
-        }
+      // already processed before a restart
+      if (!checkpoint.accept(event.weight()))
+        return;
+
+      const GenParticle* t = apply<TruthIndex>(event, "Truth").first(6);
+      if (t) {
+        const FourMomentum tmom(t->momentum());
+        hTopPtEta->fill(tmom.pt(), tmom.abseta(), event.weight());
       }
 
+      for (const TemplateConfig& c : configs)
+        fillConfig(c, event);
+
+      return;
+    }
 
 
-      const Jets& jets =
-        apply<FastJets>(event, "Jets").jetsByPt(Cuts::pT > 25*GeV && Cuts::abseta < 2.5);
+    void fillConfig(const TemplateConfig& c, const Event& event) {
+      const Jets& jets = c.jetsname.empty()
+        ? apply<TopObjects>(event, "Objects").jetsByPt(c.jetcut)
+        : apply<FastJets>(event, c.jetsname).jetsByPt(c.jetcut);
 
       size_t njets = jets.size();
-
-      size_t nbjets = 0;
-      for (const Jet& j : jets)
-        if (j.bTagged(Cuts::pT > 5*GeV))
-          nbjets++;
+      size_t nbjets = countTags(c.btagger.mask(jets));
 
 
       FourMomentum alljets;
@@ -77,24 +171,24 @@ namespace Rivet {
         alljets += j;
 
       double mass = alljets.mass();
-      hPDF->fill(mass, njets, event.weight());
+      c.hPDF->fill(mass, njets, event.weight());
 
       if (nbjets == 0) {
-        hPDF0b->fill(mass, njets, event.weight());
+        c.hPDF0b->fill(mass, njets, event.weight());
         if (njets == 2)
-          hPDF2j0b->fill(mass, event.weight());
+          c.hPDF2j0b->fill(mass, event.weight());
         else if (njets == 3)
-          hPDF3j0b->fill(mass, event.weight());
+          c.hPDF3j0b->fill(mass, event.weight());
         else if (njets == 4)
-          hPDF4j0b->fill(mass, event.weight());
+          c.hPDF4j0b->fill(mass, event.weight());
       } else if (nbjets == 1) {
-        hPDF1b->fill(mass, njets, event.weight());
+        c.hPDF1b->fill(mass, njets, event.weight());
         if (njets == 2)
-          hPDF2j1b->fill(mass, event.weight());
+          c.hPDF2j1b->fill(mass, event.weight());
         else if (njets == 3)
-          hPDF3j1b->fill(mass, event.weight());
+          c.hPDF3j1b->fill(mass, event.weight());
         else if (njets == 4)
-          hPDF4j1b->fill(mass, event.weight());
+          c.hPDF4j1b->fill(mass, event.weight());
       }
 
       return;
@@ -103,14 +197,22 @@ namespace Rivet {
 
     /// Normalise histograms etc., after the run
     void finalize() {
+      checkpoint.wait();
+
+      // Rivet's sum of weights does not include events from before a restart.
+      const double sumw = checkpoint.sumOfWeights();
 
-      vector<Histo2DPtr> h2ds = { hPDF, hPDF0b, hPDF1b, hTopPtEta };
-      for (Histo2DPtr& h : h2ds)
-        scale(h, 1.0/sumOfWeights());
+      scale(hTopPtEta, 1.0/sumw);
 
-      vector<Histo1DPtr> h1ds = { hPDF2j0b, hPDF2j1b, hPDF3j0b, hPDF3j1b, hPDF4j0b, hPDF4j1b };
-      for (Histo1DPtr& h : h1ds)
-        scale(h, 1.0/sumOfWeights());
+      for (TemplateConfig& c : configs) {
+        vector<Histo2DPtr> h2ds = { c.hPDF, c.hPDF0b, c.hPDF1b };
+        for (Histo2DPtr& h : h2ds)
+          scale(h, 1.0/sumw);
+
+        vector<Histo1DPtr> h1ds = { c.hPDF2j0b, c.hPDF2j1b, c.hPDF3j0b, c.hPDF3j1b, c.hPDF4j0b, c.hPDF4j1b };
+        for (Histo1DPtr& h : h1ds)
+          scale(h, 1.0/sumw);
+      }
 
       return;
     }
@@ -118,10 +220,13 @@ namespace Rivet {
     //@}
 
 
+    vector<TemplateConfig> configs;
+
+    Checkpoint checkpoint;
+
     /// @name Histograms
     //@{
-    Histo2DPtr hPDF, hPDF0b, hPDF1b, hTopPtEta;
-    Histo1DPtr hPDF2j0b, hPDF2j1b, hPDF3j0b, hPDF3j1b, hPDF4j0b, hPDF4j1b;
+    Histo2DPtr hTopPtEta;
     //@}
 
 
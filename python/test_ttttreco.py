@@ -0,0 +1,276 @@
+"""Tests of the ttttreco extension against the TTTT analysis.
+
+The reference functions below are line-by-line ports of the Rivet-side
+reconstruction as TTTT.cc had it before the kernels moved to
+common/TopReco.hh: full jet permutations for chi2_hadhad and ttProb, the
+template lookup of topProb, and the dR > 1.2 overlap removal of
+additionalJets.  All momenta are in GeV.
+
+run after building the extension with
+  python setup.py build_ext --inplace
+  python -m unittest discover -s python
+"""
+
+import itertools
+import math
+import os
+import random
+import shutil
+import tempfile
+import threading
+import unittest
+
+import numpy
+
+import ttttreco
+
+
+TEMPLATES = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "rivet", "toptemplate.yoda")
+
+MW, MT_MW, SIGW, SIG_MT_MW = 80.51, 85.17, 12.07, 16.05
+
+
+def read_histo2d(fname, path):
+  """(xlow, xhigh, ylow, yhigh, sumw) of every bin of a YODA Histo2D."""
+  bins = []
+  inside = False
+  with open(fname) as f:
+    for line in f:
+      line = line.strip()
+      if line == "BEGIN YODA_HISTO2D " + path:
+        inside = True
+      elif inside and line.startswith("END"):
+        return bins
+      elif inside and line and line[0] != "#" and "=" not in line and not line.startswith("Total"):
+        bins.append(tuple(float(x) for x in line.split()[:5]))
+
+  raise ValueError("%s not in %s" % (path, fname))
+
+
+def write_scaled_templates(src, dst, factor):
+  """Copy of the template file with every Histo2D bin's sumw scaled."""
+  inside = False
+  with open(src) as fin, open(dst, "w") as fout:
+    for line in fin:
+      s = line.strip()
+      if s.startswith("BEGIN YODA_HISTO2D"):
+        inside = True
+      elif s.startswith("END"):
+        inside = False
+      elif inside and s and s[0] != "#" and "=" not in s and not s.startswith("Total"):
+        cols = s.split()
+        cols[4] = "%e" % (float(cols[4]) * factor)
+        line = "\t".join(cols) + "\n"
+      fout.write(line)
+
+
+# ports of the Rivet-side TTTT reconstruction
+
+def mass(p):
+  m2 = p[3]**2 - p[0]**2 - p[1]**2 - p[2]**2
+  return -math.sqrt(-m2) if m2 < 0 else math.sqrt(m2)
+
+
+def add(*ps):
+  return tuple(sum(c) for c in zip(*ps))
+
+
+def eta(p):
+  return math.asinh(p[2] / math.hypot(p[0], p[1]))
+
+
+def delta_r(p, q):
+  dphi = abs(math.atan2(p[1], p[0]) - math.atan2(q[1], q[0]))
+  if dphi > math.pi:
+    dphi = 2*math.pi - dphi
+  return math.hypot(eta(p) - eta(q), dphi)
+
+
+def chi2_ref(jets, mw=MW, mt_mw=MT_MW):
+  if len(jets) < 6:
+    return 1e9
+
+  best = 1e9
+  for js in itertools.permutations(jets[:8], 6):
+    w1 = (mass(add(js[0], js[1])) - mw) / SIGW
+    t1 = (mass(add(js[0], js[1], js[2])) - mt_mw) / SIG_MT_MW
+    w2 = (mass(add(js[3], js[4])) - mw) / SIGW
+    t2 = (mass(add(js[3], js[4], js[5])) - mt_mw) / SIG_MT_MW
+    best = min(best, w1*w1 + t1*t1 + w2*w2 + t2*t2)
+
+  return best
+
+
+def lookup(bins, x, y):
+  for xlo, xhi, ylo, yhi, sumw in bins:
+    if xlo <= x < xhi and ylo <= y < yhi:
+      return sumw
+  return 0.0
+
+
+def top_prob_ref(pdf0b, pdf1b, jets, btags):
+  nj = len(jets)
+  if nj != 2 and nj != 3:
+    return 0.0
+
+  nb = sum(btags)
+  m = mass(add(*jets))
+  if nb > 1 or m > 400:
+    return 0.0
+
+  return lookup(pdf1b if nb else pdf0b, m, nj + 0.1)
+
+
+def tt_prob_ref(pdf0b, pdf1b, jets, btags):
+  nj = len(jets)
+  if nj < 4:
+    return 0.0
+
+  n = min(nj, 8)
+  splits = [(2, 2)]
+  if nj >= 5:
+    splits += [(2, 3), (3, 2)]
+  if nj >= 6:
+    splits += [(3, 3)]
+
+  best = 1e-50
+  for idx in itertools.permutations(range(n), min(n, 6)):
+    for a, b in splits:
+      t1, t2 = idx[:a], idx[a:a+b]
+      prob = top_prob_ref(pdf0b, pdf1b, [jets[i] for i in t1], [btags[i] for i in t1]) \
+        * top_prob_ref(pdf0b, pdf1b, [jets[i] for i in t2], [btags[i] for i in t2])
+      best = max(best, prob)
+
+  return best
+
+
+def additional_jets_ref(jets, topjets):
+  return [math.hypot(j[0], j[1]) < 60 or all(delta_r(t, j) > 1.2 for t in topjets) for j in jets]
+
+
+# random events
+
+def random_jet(rng, ptmin, ptmax):
+  pt = rng.uniform(ptmin, ptmax)
+  eta_ = rng.uniform(-2.5, 2.5)
+  phi = rng.uniform(-math.pi, math.pi)
+  m = rng.uniform(2, 15)
+  px, py, pz = pt*math.cos(phi), pt*math.sin(phi), pt*math.sinh(eta_)
+  return (px, py, pz, math.sqrt(px*px + py*py + pz*pz + m*m))
+
+
+def random_events(rng, nevt, nmin, nmax, ptmin=25, ptmax=250):
+  """Jets sorted by decreasing pT, b-tags and offsets, as TTTT sees them."""
+  events = []
+  for _ in range(nevt):
+    js = [random_jet(rng, ptmin, ptmax) for _ in range(rng.randint(nmin, nmax))]
+    js.sort(key=lambda p: -math.hypot(p[0], p[1]))
+    events.append((js, [rng.random() < 0.3 for _ in js]))
+
+  return events
+
+
+def batch(events):
+  jets = numpy.array([j for js, _ in events for j in js], dtype=numpy.float64).reshape(-1, 4)
+  btag = numpy.array([b for _, bs in events for b in bs], dtype=bool)
+  offsets = numpy.cumsum([0] + [len(js) for js, _ in events]).astype(numpy.int64)
+  return jets, btag, offsets
+
+
+class TestAgainstTTTT(unittest.TestCase):
+
+  @classmethod
+  def setUpClass(cls):
+    ttttreco.load_templates(TEMPLATES)
+    cls.pdf0b = read_histo2d(TEMPLATES, "/HadTop/ttPDF0b")
+    cls.pdf1b = read_histo2d(TEMPLATES, "/HadTop/ttPDF1b")
+
+  def test_chi2_hadhad(self):
+    events = random_events(random.Random(1), 12, 4, 8)
+    jets, _, offsets = batch(events)
+
+    for nthreads in (1, 3):
+      res = ttttreco.chi2_hadhad(jets, offsets, nthreads=nthreads)
+      self.assertEqual(res.shape, (len(events), 1))
+      for i, (js, _) in enumerate(events):
+        self.assertAlmostEqual(res[i, 0], chi2_ref(js), delta=1e-9*max(1, res[i, 0]))
+
+  def test_chi2_hadhad_hypotheses(self):
+    events = random_events(random.Random(2), 6, 6, 7)
+    jets, _, offsets = batch(events)
+    mw = numpy.array([75.0, 85.0])
+    mt_mw = numpy.array([90.0, 80.0])
+
+    res = ttttreco.chi2_hadhad(jets, offsets, mw=mw, mt_mw=mt_mw)
+    self.assertEqual(res.shape, (len(events), 2))
+    for i, (js, _) in enumerate(events):
+      for h in range(2):
+        self.assertAlmostEqual(res[i, h], chi2_ref(js, mw[h], mt_mw[h]), delta=1e-9*max(1, res[i, h]))
+
+  def test_tt_prob(self):
+    # soft jets, so that most two- and three-jet masses are on the templates
+    events = random_events(random.Random(3), 15, 3, 7, ptmin=20, ptmax=90)
+    jets, btag, offsets = batch(events)
+
+    nonzero = 0
+    for nthreads in (1, 4):
+      res = ttttreco.tt_prob(jets, btag, offsets, nthreads=nthreads)
+      for i, (js, bs) in enumerate(events):
+        ref = tt_prob_ref(self.pdf0b, self.pdf1b, js, bs)
+        self.assertAlmostEqual(res[i], ref, delta=1e-12*max(1e-50, ref))
+        nonzero += ref > 1e-50
+
+    # the comparison is only meaningful if some events get a probability
+    self.assertGreater(nonzero, 0)
+
+  def test_additional_jets(self):
+    rng = random.Random(4)
+    events = random_events(rng, 20, 0, 10, ptmin=25, ptmax=200)
+    tops = random_events(rng, 20, 0, 2, ptmin=300, ptmax=800)
+    jets, _, offsets = batch(events)
+    topjets, _, topoffsets = batch(tops)
+
+    res = ttttreco.additional_jets(jets, offsets, topjets, topoffsets, nthreads=2)
+    ref = [k for (js, _), (ts, _) in zip(events, tops) for k in additional_jets_ref(js, ts)]
+    self.assertEqual(list(res), ref)
+
+  def test_reload_during_batches(self):
+    # load_templates alternating between two template files on one thread
+    # while tt_prob batches run on another: every batch must use one
+    # complete set of templates from start to end.
+    tmpdir = tempfile.mkdtemp()
+    try:
+      scaled = os.path.join(tmpdir, "scaled.yoda")
+      write_scaled_templates(TEMPLATES, scaled, 2.0)
+
+      events = random_events(random.Random(5), 200, 4, 6, ptmin=20, ptmax=90)
+      jets, btag, offsets = batch(events)
+      ttttreco.load_templates(scaled)
+      expected_scaled = ttttreco.tt_prob(jets, btag, offsets)
+      ttttreco.load_templates(TEMPLATES)
+      expected = ttttreco.tt_prob(jets, btag, offsets)
+      self.assertFalse(numpy.array_equal(expected, expected_scaled))
+
+      done = []
+      def reload():
+        while not done:
+          ttttreco.load_templates(scaled)
+          ttttreco.load_templates(TEMPLATES)
+
+      t = threading.Thread(target=reload)
+      t.start()
+      try:
+        for _ in range(50):
+          res = ttttreco.tt_prob(jets, btag, offsets, nthreads=4)
+          self.assertTrue(numpy.array_equal(res, expected) or numpy.array_equal(res, expected_scaled))
+      finally:
+        done.append(True)
+        t.join()
+
+      ttttreco.load_templates(TEMPLATES)
+    finally:
+      shutil.rmtree(tmpdir)
+
+
+if __name__ == "__main__":
+  unittest.main()
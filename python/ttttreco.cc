@@ -0,0 +1,491 @@
+// -*- C++ -*-
+//
+// ttttreco: the TTTT reconstruction kernels (common/TopReco.hh) on NumPy
+// batches.
+//
+// A batch of events is given as
+//   jets     float64 array (njets, 4) of (px, py, pz, E) in GeV
+//   btag     bool array (njets,)
+//   offsets  int64 array (nevt+1,): event i owns jets[offsets[i]:offsets[i+1]]
+//
+// Arrays that already have this dtype and are C-contiguous are used in
+// place, without copying.  The batch is processed with the GIL released,
+// split over nthreads threads.
+//
+// The top templates are read from toptemplate.yoda on first use (or from
+// the file given to load_templates).  load_templates may be called while
+// batches run on other threads: each batch keeps the templates it started
+// with.
+//
+// build with
+//   python setup.py build_ext --inplace
+
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+#include "YODA/ReaderYODA.h"
+#include "../common/TopReco.hh"
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Rivet;
+
+namespace {
+
+  struct Templates {
+    TopTemplate pdf0b, pdf1b;
+  };
+
+  /// The loaded templates.  Only read or replaced with the GIL held; a
+  /// batch takes its own reference before releasing the GIL, so a
+  /// load_templates() from another thread cannot free the templates a
+  /// running batch is using.
+  std::shared_ptr<const Templates> templates;
+
+
+  /// Owns one reference to a Python object.
+  struct PyRef {
+    PyObject* obj;
+
+    explicit PyRef(PyObject* o = NULL) : obj(o) { }
+    ~PyRef() { Py_XDECREF(obj); }
+
+    PyArrayObject* arr() const { return (PyArrayObject*) obj; }
+    PyObject* release() { PyObject* o = obj; obj = NULL; return o; }
+
+  private:
+    PyRef(const PyRef&);
+    PyRef& operator=(const PyRef&);
+  };
+
+
+  /// Event-indexed view of jets, b-tags and offsets.
+  struct Batch {
+    const JetP4* jets;
+    const npy_bool* btag;
+    const npy_int64* offsets;
+    size_t njets, nevt;
+
+    size_t size(size_t i) const { return offsets[i+1] - offsets[i]; }
+    const JetP4* event(size_t i) const { return jets + offsets[i]; }
+
+    TagMask mask(size_t i) const {
+      TagMask m = 0;
+      if (!btag)
+        return m;
+
+      const npy_bool* b = btag + offsets[i];
+      for (size_t k = 0; k < size(i) && k < MAXTAGJETS; k++)
+        if (b[k])
+          m |= TagMask(1) << k;
+
+      return m;
+    }
+  };
+
+
+  bool loadTemplates(const std::string& fname) {
+    std::vector<YODA::AnalysisObject*> aos;
+    try {
+      aos = YODA::ReaderYODA::create().read(fname);
+    } catch (const std::exception& e) {
+      PyErr_Format(PyExc_IOError, "cannot read %s: %s", fname.c_str(), e.what());
+      return false;
+    }
+
+    std::shared_ptr<Templates> loaded = std::make_shared<Templates>();
+    bool found0b = false, found1b = false;
+    for (YODA::AnalysisObject* ao : aos) {
+      std::unique_ptr<YODA::AnalysisObject> owner(ao);
+      const YODA::Histo2D* h = dynamic_cast<const YODA::Histo2D*>(ao);
+      if (!h)
+        continue;
+
+      if (h->path() == "/HadTop/ttPDF0b") {
+        loaded->pdf0b = TopTemplate(*h);
+        found0b = true;
+      } else if (h->path() == "/HadTop/ttPDF1b") {
+        loaded->pdf1b = TopTemplate(*h);
+        found1b = true;
+      }
+    }
+
+    if (!found0b || !found1b) {
+      PyErr_Format(PyExc_ValueError, "%s lacks /HadTop/ttPDF0b or /HadTop/ttPDF1b", fname.c_str());
+      return false;
+    }
+
+    templates = loaded;
+    return true;
+  }
+
+  /// The current templates, loading the default file on first use;
+  /// NULL with the Python error set if that fails.
+  std::shared_ptr<const Templates> currentTemplates() {
+    if (!templates && !loadTemplates("toptemplate.yoda"))
+      return std::shared_ptr<const Templates>();
+
+    return templates;
+  }
+
+
+  /// Wrap @a obj as a C-contiguous array of @a type, copying only if needed.
+  PyArrayObject* asArray(PyObject* obj, int type, const char* name, int ndim, npy_intp dim1 = 0) {
+    PyArrayObject* arr = (PyArrayObject*) PyArray_FROM_OTF(obj, type, NPY_ARRAY_IN_ARRAY);
+    if (!arr)
+      return NULL;
+
+    if (PyArray_NDIM(arr) != ndim || (ndim == 2 && PyArray_DIM(arr, 1) != dim1)) {
+      PyErr_Format(PyExc_ValueError, "%s has the wrong shape", name);
+      Py_DECREF(arr);
+      return NULL;
+    }
+
+    return arr;
+  }
+
+  /// Check and fill in @a batch; the PyRefs keep the arrays alive.
+  bool makeBatch(PyObject* jetsobj, PyObject* btagobj, PyObject* offsobj
+      , PyRef& jets, PyRef& btag, PyRef& offs, Batch& batch) {
+    jets.obj = (PyObject*) asArray(jetsobj, NPY_DOUBLE, "jets", 2, 4);
+    if (!jets.obj)
+      return false;
+
+    offs.obj = (PyObject*) asArray(offsobj, NPY_INT64, "offsets", 1);
+    if (!offs.obj)
+      return false;
+
+    batch.jets = (const JetP4*) PyArray_DATA(jets.arr());
+    batch.njets = PyArray_DIM(jets.arr(), 0);
+    batch.offsets = (const npy_int64*) PyArray_DATA(offs.arr());
+    batch.nevt = PyArray_DIM(offs.arr(), 0) ? PyArray_DIM(offs.arr(), 0) - 1 : 0;
+    batch.btag = NULL;
+
+    if (btagobj && btagobj != Py_None) {
+      btag.obj = (PyObject*) asArray(btagobj, NPY_BOOL, "btag", 1);
+      if (!btag.obj)
+        return false;
+      if ((size_t) PyArray_DIM(btag.arr(), 0) != batch.njets) {
+        PyErr_SetString(PyExc_ValueError, "btag and jets have different lengths");
+        return false;
+      }
+      batch.btag = (const npy_bool*) PyArray_DATA(btag.arr());
+    }
+
+    for (size_t i = 0; i < batch.nevt; i++) {
+      if (batch.offsets[i] < 0 || batch.offsets[i] > batch.offsets[i+1]
+          || (size_t) batch.offsets[i+1] > batch.njets) {
+        PyErr_SetString(PyExc_ValueError, "offsets must be non-decreasing and within jets");
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+  /// Run f(begin, end) over contiguous chunks of [0, n) on nthreads
+  /// threads, with the GIL released.
+  ///
+  /// Exceptions must not leave a worker thread or cross
+  /// Py_END_ALLOW_THREADS, so every chunk catches its own; the first one
+  /// is raised as MemoryError or RuntimeError once the GIL is back.
+  /// Returns false with the Python error set in that case.
+  bool parallelEvents(size_t n, int nthreads, const std::function<void(size_t, size_t)>& f) {
+    const size_t nt = std::max(1, std::min(nthreads, (int) std::max(n, (size_t) 1)));
+    std::vector<std::exception_ptr> errors(nt);
+
+    auto chunk = [&](size_t t, size_t begin, size_t end) {
+      try {
+        f(begin, end);
+      } catch (...) {
+        errors[t] = std::current_exception();
+      }
+    };
+
+    Py_BEGIN_ALLOW_THREADS
+
+    if (nt == 1) {
+      chunk(0, 0, n);
+    } else {
+      std::vector<std::thread> pool;
+      const size_t size = (n + nt - 1) / nt;
+      for (size_t t = 0; t < nt; t++) {
+        const size_t begin = std::min(n, t*size);
+        const size_t end = std::min(n, begin + size);
+        try {
+          pool.emplace_back(chunk, t, begin, end);
+        } catch (...) {
+          // could not start a thread: give up on the rest.
+          errors[t] = std::current_exception();
+          break;
+        }
+      }
+
+      for (std::thread& th : pool)
+        th.join();
+    }
+
+    Py_END_ALLOW_THREADS
+
+    for (const std::exception_ptr& e : errors) {
+      if (!e)
+        continue;
+
+      try {
+        std::rethrow_exception(e);
+      } catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+      } catch (const std::exception& ex) {
+        PyErr_SetString(PyExc_RuntimeError, ex.what());
+      } catch (...) {
+        PyErr_SetString(PyExc_RuntimeError, "unknown C++ exception");
+      }
+      return false;
+    }
+
+    return true;
+  }
+
+
+  PyObject* py_load_templates(PyObject*, PyObject* args) {
+    const char* fname;
+    if (!PyArg_ParseTuple(args, "s", &fname))
+      return NULL;
+
+    if (!loadTemplates(fname))
+      return NULL;
+
+    Py_RETURN_NONE;
+  }
+
+
+  PyObject* py_chi2_hadhad(PyObject*, PyObject* args, PyObject* kwargs) {
+    static const char* kwlist[] = { "jets", "offsets", "mw", "mt_mw", "sigw", "sig_mt_mw", "nthreads", NULL };
+    PyObject *jetsobj, *offsobj, *mwobj = NULL, *mtmwobj = NULL;
+    double sigw = default_sigw, sig_mt_mw = default_sig_mt_mw;
+    int nthreads = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OO|OOddi", (char**) kwlist
+          , &jetsobj, &offsobj, &mwobj, &mtmwobj, &sigw, &sig_mt_mw, &nthreads))
+      return NULL;
+
+    PyRef jets, btag, offs;
+    Batch batch;
+    if (!makeBatch(jetsobj, NULL, offsobj, jets, btag, offs, batch))
+      return NULL;
+
+    // hypotheses are given pairwise: mw[i], mt_mw[i]
+    MassHypotheses hyps;
+    hyps.sigw = sigw;
+    hyps.sig_mt_mw = sig_mt_mw;
+    const bool hasmw = mwobj && mwobj != Py_None;
+    const bool hasmtmw = mtmwobj && mtmwobj != Py_None;
+    if (hasmw != hasmtmw) {
+      PyErr_SetString(PyExc_ValueError, "give both mw and mt_mw, or neither");
+      return NULL;
+    }
+
+    if (hasmw) {
+      PyRef mw((PyObject*) asArray(mwobj, NPY_DOUBLE, "mw", 1));
+      if (!mw.obj)
+        return NULL;
+      PyRef mtmw((PyObject*) asArray(mtmwobj, NPY_DOUBLE, "mt_mw", 1));
+      if (!mtmw.obj)
+        return NULL;
+      if (PyArray_DIM(mw.arr(), 0) != PyArray_DIM(mtmw.arr(), 0)) {
+        PyErr_SetString(PyExc_ValueError, "mw and mt_mw have different lengths");
+        return NULL;
+      }
+
+      const double* m1 = (const double*) PyArray_DATA(mw.arr());
+      const double* m2 = (const double*) PyArray_DATA(mtmw.arr());
+      for (npy_intp i = 0; i < PyArray_DIM(mw.arr(), 0); i++)
+        hyps.add(m1[i], m2[i]);
+    } else {
+      hyps.add(default_mw, default_mt_mw);
+    }
+
+    const size_t nh = hyps.size();
+    npy_intp dims[2] = { (npy_intp) batch.nevt, (npy_intp) nh };
+    PyRef out(PyArray_SimpleNew(2, dims, NPY_DOUBLE));
+    if (!out.obj)
+      return NULL;
+    double* res = (double*) PyArray_DATA(out.arr());
+
+    bool ok = parallelEvents(batch.nevt, nthreads, [&](size_t begin, size_t end) {
+        std::vector<double> minchi2;
+        for (size_t i = begin; i < end; i++) {
+          chi2_hadhad(batch.event(i), batch.size(i), hyps, minchi2);
+          std::copy(minchi2.begin(), minchi2.end(), res + i*nh);
+        }
+      });
+    if (!ok)
+      return NULL;
+
+    return out.release();
+  }
+
+
+  PyObject* py_tt_prob(PyObject*, PyObject* args, PyObject* kwargs) {
+    static const char* kwlist[] = { "jets", "btag", "offsets", "nthreads", NULL };
+    PyObject *jetsobj, *btagobj, *offsobj;
+    int nthreads = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|i", (char**) kwlist
+          , &jetsobj, &btagobj, &offsobj, &nthreads))
+      return NULL;
+
+    const std::shared_ptr<const Templates> tmpl = currentTemplates();
+    if (!tmpl)
+      return NULL;
+
+    PyRef jets, btag, offs;
+    Batch batch;
+    if (!makeBatch(jetsobj, btagobj, offsobj, jets, btag, offs, batch))
+      return NULL;
+
+    npy_intp dims[1] = { (npy_intp) batch.nevt };
+    PyRef out(PyArray_SimpleNew(1, dims, NPY_DOUBLE));
+    if (!out.obj)
+      return NULL;
+    double* res = (double*) PyArray_DATA(out.arr());
+
+    bool ok = parallelEvents(batch.nevt, nthreads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+          res[i] = ttProb(tmpl->pdf0b, tmpl->pdf1b, batch.event(i), batch.size(i), batch.mask(i));
+      });
+    if (!ok)
+      return NULL;
+
+    return out.release();
+  }
+
+
+  PyObject* py_top_prob(PyObject*, PyObject* args, PyObject* kwargs) {
+    static const char* kwlist[] = { "jets", "btag", "offsets", "nthreads", NULL };
+    PyObject *jetsobj, *btagobj, *offsobj;
+    int nthreads = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOO|i", (char**) kwlist
+          , &jetsobj, &btagobj, &offsobj, &nthreads))
+      return NULL;
+
+    const std::shared_ptr<const Templates> tmpl = currentTemplates();
+    if (!tmpl)
+      return NULL;
+
+    PyRef jets, btag, offs;
+    Batch batch;
+    if (!makeBatch(jetsobj, btagobj, offsobj, jets, btag, offs, batch))
+      return NULL;
+
+    npy_intp dims[1] = { (npy_intp) batch.nevt };
+    PyRef out(PyArray_SimpleNew(1, dims, NPY_DOUBLE));
+    if (!out.obj)
+      return NULL;
+    double* res = (double*) PyArray_DATA(out.arr());
+
+    // every event's jets form one top candidate
+    bool ok = parallelEvents(batch.nevt, nthreads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+          const JetP4* js = batch.event(i);
+          JetP4 sum = { 0, 0, 0, 0 };
+          for (size_t k = 0; k < batch.size(i); k++)
+            sum += js[k];
+
+          res[i] = topProb(tmpl->pdf0b, tmpl->pdf1b, sum, batch.size(i), countTags(batch.mask(i)));
+        }
+      });
+    if (!ok)
+      return NULL;
+
+    return out.release();
+  }
+
+
+  PyObject* py_additional_jets(PyObject*, PyObject* args, PyObject* kwargs) {
+    static const char* kwlist[] = { "jets", "offsets", "topjets", "topoffsets", "nthreads", NULL };
+    PyObject *jetsobj, *offsobj, *topjetsobj, *topoffsobj;
+    int nthreads = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OOOO|i", (char**) kwlist
+          , &jetsobj, &offsobj, &topjetsobj, &topoffsobj, &nthreads))
+      return NULL;
+
+    PyRef jets, btag, offs, topjets, topbtag, topoffs;
+    Batch batch, topbatch;
+    if (!makeBatch(jetsobj, NULL, offsobj, jets, btag, offs, batch)
+        || !makeBatch(topjetsobj, NULL, topoffsobj, topjets, topbtag, topoffs, topbatch))
+      return NULL;
+
+    if (batch.nevt != topbatch.nevt) {
+      PyErr_SetString(PyExc_ValueError, "jets and topjets have different numbers of events");
+      return NULL;
+    }
+
+    npy_intp dims[1] = { (npy_intp) batch.njets };
+    PyRef out(PyArray_ZEROS(1, dims, NPY_BOOL, 0));
+    if (!out.obj)
+      return NULL;
+    npy_bool* res = (npy_bool*) PyArray_DATA(out.arr());
+
+    bool ok = parallelEvents(batch.nevt, nthreads, [&](size_t begin, size_t end) {
+        std::vector<size_t> keep;
+        TagMask addmask;
+        for (size_t i = begin; i < end; i++) {
+          keep.clear();
+          additionalJets(batch.event(i), batch.size(i), 0
+              , topbatch.event(i), topbatch.size(i), keep, addmask);
+          for (size_t k : keep)
+            res[batch.offsets[i] + k] = NPY_TRUE;
+        }
+      });
+    if (!ok)
+      return NULL;
+
+    return out.release();
+  }
+
+
+  PyMethodDef methods[] = {
+    { "load_templates", (PyCFunction) py_load_templates, METH_VARARGS,
+      "load_templates(fname): read /HadTop/ttPDF0b and ttPDF1b from a YODA file" },
+    { "chi2_hadhad", (PyCFunction) py_chi2_hadhad, METH_VARARGS | METH_KEYWORDS,
+      "chi2_hadhad(jets, offsets, mw=None, mt_mw=None, sigw=12.07, sig_mt_mw=16.05, nthreads=1)\n"
+      "-> (nevt, nhypotheses) minimum chi2 per event and (mw[i], mt_mw[i]) hypothesis" },
+    { "tt_prob", (PyCFunction) py_tt_prob, METH_VARARGS | METH_KEYWORDS,
+      "tt_prob(jets, btag, offsets, nthreads=1) -> (nevt,) best two-top probability" },
+    { "top_prob", (PyCFunction) py_top_prob, METH_VARARGS | METH_KEYWORDS,
+      "top_prob(jets, btag, offsets, nthreads=1) -> (nevt,) probability that each event's jets form one top" },
+    { "additional_jets", (PyCFunction) py_additional_jets, METH_VARARGS | METH_KEYWORDS,
+      "additional_jets(jets, offsets, topjets, topoffsets, nthreads=1)\n"
+      "-> (njets,) bool, true for jets not overlapping with a top jet" },
+    { NULL, NULL, 0, NULL }
+  };
+
+}
+
+
+#if PY_MAJOR_VERSION >= 3
+
+static PyModuleDef moduledef = {
+  PyModuleDef_HEAD_INIT, "ttttreco", "TTTT reconstruction kernels on NumPy batches", -1, methods
+};
+
+PyMODINIT_FUNC PyInit_ttttreco() {
+  import_array();
+  return PyModule_Create(&moduledef);
+}
+
+#else
+
+PyMODINIT_FUNC initttttreco() {
+  import_array();
+  Py_InitModule3("ttttreco", methods, "TTTT reconstruction kernels on NumPy batches");
+}
+
+#endif
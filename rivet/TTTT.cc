@@ -1,25 +1,17 @@
 // -*- C++ -*-
 #include "Rivet/Analysis.hh"
-#include "Rivet/Projections/FinalState.hh"
-#include "Rivet/Projections/PromptFinalState.hh"
-#include "Rivet/Projections/ChargedLeptons.hh"
 #include "Rivet/Projections/FastJets.hh"
-#include "Rivet/Projections/VetoedFinalState.hh"
+#include "../common/TopObjects.hh"
 #include "YODA/ReaderYODA.h"
+#include "../common/Config.hh"
+#include "../common/Checkpoint.hh"
+#include "../common/Normalisation.hh"
+#include "../common/BTagging.hh"
+#include "../common/TopReco.hh"
+#include <fnmatch.h>
 
 namespace Rivet {
 
-  // from https://stackoverflow.com/questions/3418231/replace-part-of-a-string-with-another-string
-  string replace(const string& str, const string& from, const string& to) {
-    string ret = str;
-    size_t start_pos = str.find(from);
-    if(start_pos == std::string::npos)
-      return ret;
-    ret.replace(start_pos, from.length(), to);
-    return ret;
-  }
-
-
   const string ptstr = "\\ensuremath{p_\\mathrm{T}}";
   const string chi2str = "\\ensuremath{\\chi^2}";
   const string logttprobstr = "\\ensuremath{log(\\text{Prob}(tt)})";
@@ -37,173 +29,62 @@ namespace Rivet {
     return dxdy("\\sigma", y, "\\mathrm{pb}", yunit);
   }
 
-  bool cmp_pt(const Jet& j1, const Jet& j2) {
-    return j1.pt() > j2.pt();
-  }
-
-  template<class T>
-  pair<vector<T>, vector<T>> splitAt(const vector<T>& v, size_t n) {
-    if (v.size() < n)
-      return make_pair(v, vector<T>());
-    else
-      return make_pair(vector<T>(v.begin(), v.begin()+n), vector<T>(v.begin()+n, v.end()));
-  }
-
-
-  double mw = 80.51*GeV;
-  double mt_mw = 85.17*GeV;
-  double sigw = 12.07*GeV;
-  double sig_mt_mw = 16.05*GeV;
-
-  double chi2_hadhad(const Jets& jets) {
-    double minchi2 = 1e9;
-    if (jets.size() < 6)
-      return minchi2;
-
-    // TODO
-    // only look at up to the first eight jets for now...
-    Jets js;
-    size_t mx = jets.size();
-    if (mx > 8)
-      mx = 8;
-
-    for (size_t i = 0; i < mx; i++)
-      js.push_back(jets[i]);
-
-    // TODO
-    // this will be extremely inefficient for large jet multiplicities
-    // because we will double-check some permutations.
-    // oh well.
-    size_t count = 0;
-    do {
-      double mjj1 = (js[0].mom() + js[1].mom()).mass();
-      double mt_w1 = (js[0].mom() + js[1].mom() + js[2].mom()).mass();
-      double mjj2 = (js[3].mom() + js[4].mom()).mass();
-      double mt_w2 = (js[3].mom() + js[4].mom() + js[5].mom()).mass();
-
-      double w1term = (mjj1 - mw) / sigw;
-      double t1term = (mt_w1 - mt_mw) / sig_mt_mw;
-      double w2term = (mjj2 - mw) / sigw;
-      double t2term = (mt_w2 - mt_mw) / sig_mt_mw;
+  // the reconstruction itself lives in common/TopReco.hh, shared with
+  // the ttttreco Python extension; these adapt it to Rivet Jets.
 
-      double chi2 = w1term*w1term + t1term*t1term + w2term*w2term + t2term*t2term;
-
-      if (chi2 < minchi2)
-        minchi2 = chi2;
-
-      count++;
-    } while (next_permutation(js.begin(), js.end(), cmp_pt));
-
-    return minchi2;
-  }
-
-  double topProb(const Histo2D& topPDF0b, const Histo2D& topPDF1b, const Jets& jets) {
-    size_t nj = jets.size();
-    if (nj != 2 && nj != 3)
-      return 0.0;
-
-    size_t nb = 0;
-    FourMomentum alljets;
-    for (const Jet& jet : jets) {
-      if (jet.bTagged(Cuts::pT > 5*GeV && Cuts::abseta < 2.5))
-        nb++;
-
-      alljets += jet.mom();
+  /// Overwrite @a p4s with the four-momenta of @a jets, keeping its capacity.
+  void jetP4s(const Jets& jets, vector<JetP4>& p4s) {
+    p4s.clear();
+    for (const Jet& j : jets) {
+      const JetP4 p4 = { j.px()/GeV, j.py()/GeV, j.pz()/GeV, j.E()/GeV };
+      p4s.push_back(p4);
     }
 
-    double mass = alljets.mass();
-    if (nb > 1 || mass > 400)
-      return 0.0;
-
-    // cout << "mass: " << mass << endl;
-    // cout << "njets: " << nj << endl;
-    // cout << "nbjets: " << nb << endl;
-
-    if (nb)
-      return topPDF1b.binAt(alljets.mass(), nj + 0.1).volume();
-    else
-      return topPDF0b.binAt(alljets.mass(), nj + 0.1).volume();
+    return;
   }
 
-  double ttProb(const Histo2D& topPDF0b, const Histo2D& topPDF1b, const Jets& jets) {
-    size_t nj = jets.size();
-
-    if (nj < 4)
-      return 0.0;
-
-    // only look at the first 8 jets for now.
-    Jets js;
-    for (size_t i = 0; i < jets.size() && i < 8; i++)
-      js.push_back(jets[i]);
-
-    double bestprob = 1e-50;
-    do {
-      double prob;
-      pair<Jets, Jets> top1_rest;
-      pair<Jets, Jets> top2_rest;
- 
-        
-      top1_rest = splitAt(js, 2);
-      top2_rest = splitAt(top1_rest.second, 2);
+  // disabled histograms are null pointers: filling them is a no-op.
 
-      // cout << "top1 length: " << top1_rest.first.size() << endl;
-      // cout << "top2 length: " << top2_rest.first.size() << endl;
-
-      prob = topProb(topPDF0b, topPDF1b, top1_rest.first) * topProb(topPDF0b, topPDF1b, top2_rest.first);
-
-      if (prob > bestprob)
-        bestprob = prob;
-
-
-      if (nj < 5)
-        continue;
-
-      top1_rest = splitAt(js, 2);
-      top2_rest = splitAt(top1_rest.second, 3);
-
-      // cout << "top1 length: " << top1_rest.first.size() << endl;
-      // cout << "top2 length: " << top2_rest.first.size() << endl;
-
-      prob = topProb(topPDF0b, topPDF1b, top1_rest.first) * topProb(topPDF0b, topPDF1b, top2_rest.first);
-
-      if (prob > bestprob)
-        bestprob = prob;
-
-
-      top1_rest = splitAt(js, 3);
-      top2_rest = splitAt(top1_rest.second, 2);
-
-      // cout << "top1 length: " << top1_rest.first.size() << endl;
-      // cout << "top2 length: " << top2_rest.first.size() << endl;
-
-      prob = topProb(topPDF0b, topPDF1b, top1_rest.first) * topProb(topPDF0b, topPDF1b, top2_rest.first);
-
-      if (prob > bestprob)
-        bestprob = prob;
-
-
-      if (nj < 6)
-        continue;
-
-      top1_rest = splitAt(js, 3);
-      top2_rest = splitAt(top1_rest.second, 3);
-
-      // cout << "top1 length: " << top1_rest.first.size() << endl;
-      // cout << "top2 length: " << top2_rest.first.size() << endl;
-
-      prob = topProb(topPDF0b, topPDF1b, top1_rest.first) * topProb(topPDF0b, topPDF1b, top2_rest.first);
-
-      if (prob > bestprob)
-        bestprob = prob;
+  void fill(const Histo1DPtr& h, double x, double w) {
+    if (h)
+      h->fill(x, w);
+    return;
+  }
 
-    } while (next_permutation(js.begin(), js.end(), cmp_pt));
+  bool booked(const vector<Histo1DPtr>& hs) {
+    for (const Histo1DPtr& h : hs)
+      if (h)
+        return true;
 
-    cout << "bestprob: " << bestprob << endl;
-    return bestprob;
+    return false;
   }
 
 
   /// @brief Add a short analysis description here
+  ///
+  /// Run settings are read from the file named by TTTT_CONFIG, if set:
+  /// the checkpoint_every / checkpoint_file / resume options of
+  /// Checkpoint, and the chi2_hadhad mass hypotheses
+  ///
+  ///   chi2_mw = <n> <first/GeV> <last/GeV>
+  ///   chi2_mt_mw = <n> <first/GeV> <last/GeV>
+  ///   chi2_sigw = <GeV>
+  ///   chi2_sig_mt_mw = <GeV>
+  ///
+  /// The n x n grid gets one chi2_JJ_h<i> and chi2_lJ_h<i> histogram per
+  /// hypothesis; with the default single hypothesis they are plain
+  /// chi2_JJ and chi2_lJ.
+  ///
+  /// Histograms can be switched off by name with shell-style patterns,
+  ///
+  ///   enable = <pattern> ...
+  ///   disable = <pattern> ...
+  ///
+  /// A histogram is booked if it matches an enable pattern (or there are
+  /// none) and no disable pattern.  Disabled histograms are not written,
+  /// and the reconstruction only they need is skipped: e.g. with
+  /// "disable = chi2_* logttprob_*" chi2_hadhad and ttProb never run, and
+  /// a channel without any enabled histogram is not looked at.
   class TTTT : public Analysis {
   public:
 
@@ -217,6 +98,10 @@ namespace Rivet {
     /// Book histograms and initialise projections before the run
     void init() {
 
+      const ConfigFile cfg = ConfigFile::fromEnv("TTTT_CONFIG");
+      enabled = patterns(cfg, "enable");
+      disabled = patterns(cfg, "disable");
+
       // read in control histograms for top tagging
 
       YODA::Reader& r = YODA::ReaderYODA::create();
@@ -225,10 +110,10 @@ namespace Rivet {
 
       for (AnalysisObject* aoptr : inputHists) {
         if (aoptr->path() == "/HadTop/ttPDF0b") {
-          topPDF0b = * ((Histo2D*) aoptr);
+          topPDF0b = TopTemplate(* ((Histo2D*) aoptr));
           cout << "found /HadTop/ttPDF0b" << endl;
         } else if (aoptr->path() == "/HadTop/ttPDF1b") {
-          topPDF1b = * ((Histo2D*) aoptr);
+          topPDF1b = TopTemplate(* ((Histo2D*) aoptr));
           cout << "found /HadTop/ttPDF1b" << endl;
         }
 
@@ -238,17 +123,17 @@ namespace Rivet {
       }
 
       // Initialise and register projections
-      PromptFinalState pls(ChargedLeptons(Cuts::abseta < 2.5 && Cuts::pT > 25*GeV), true);
-      declare(pls, "PromptLeptons");
 
-      // build jets out of all stable particles that aren't invisible
-      // and aren't prompt leptons
-      VetoedFinalState vfs(FinalState(Cuts::abseta < 5.0 && Cuts::pT > 100*MeV));
-      vfs.addVetoOnThisFinalState(pls);
+      // prompt leptons and small-R jets, shared with HadTop
+      declare(TopObjects(), "Objects");
 
-      declare(FastJets(vfs, FastJets::ANTIKT, 0.4), "Jets");
-      declare(FastJets(vfs, FastJets::ANTIKT, 1.0), "FatJets");
+      // large-R jets from the same inputs
+      declare(TopObjects::antiKtJets(1.0), "FatJets");
 
+      // selection cuts are built once here rather than per event.
+      centjetcut = Cuts::pT > 25*GeV && Cuts::abseta < 2.5;
+      fwdjetcut = Cuts::pT > 25*GeV && Cuts::abseta > 2.5;
+      topjetcut = Cuts::pT > 300*GeV && Cuts::abseta < 2.0 && Cuts::mass > 100*GeV;
 
       njets = bookH("njets", 21, -0.5, 20.5, "njets", "jet multiplicity", dsigdy(nstr, "1"));
       ncentjets = bookH("ncentjets", 21, -0.5, 20.5, "ncentjets", "central jet multiplicity", dsigdy(nstr, "1"));
@@ -274,7 +159,8 @@ namespace Rivet {
       dphitt_JJ = bookH("dphitt_JJ", 20, 0, 4, "dphitt_JJ", dphittstr, dsigdy(dphittstr, "\\mathrm{rad}"));
       pttt_JJ = bookH("pttt_JJ", 25, 0, 1, "pttt_JJ", ptttstr + " [TeV]", dsigdy(ptttstr, "\\mathrm{TeV}"));
       mtt_JJ = bookH("mtt_JJ", 15, 0, 3, "mtt_JJ", "$tt$ invariant mass [TeV]", dsigdy(mttstr, "\\mathrm{TeV}"));
-      chi2_JJ = bookH("chi2_JJ", 20, 0, 1000, "chi2_JJ", chi2str, dsigdy(chi2str, "1"));
+      configureMassHypotheses(cfg);
+      chi2_JJ = bookChi2("chi2_JJ");
       logttprob_JJ = bookH("logttprob_JJ", 20, -20, 0, "logttprob_JJ", logttprobstr, dsigdy(logttprobstr, "1"));
 
       njets_lJ = bookH("njets_lJ", 21, -0.5, 20.5, "njets_lJ", "jet multiplicity", dsigdy(nstr, "1"));
@@ -294,7 +180,7 @@ namespace Rivet {
       dphitt_lJ = bookH("dphitt_lJ", 20, 0, 4, "dphitt_lJ", dphittstr, dsigdy(dphittstr, "\\mathrm{rad}"));
       pttt_lJ = bookH("pttt_lJ", 25, 0, 1, "pttt_lJ", ptttstr + " [TeV]", dsigdy(ptttstr, "\\mathrm{TeV}"));
       mtt_lJ = bookH("mtt_lJ", 15, 0, 3, "mtt_lJ", "$tt$ invariant mass [TeV]", dsigdy(mttstr, "\\mathrm{TeV}"));
-      chi2_lJ = bookH("chi2_lJ", 20, 0, 1000, "chi2_lJ", chi2str, dsigdy(chi2str, "1"));
+      chi2_lJ = bookChi2("chi2_lJ");
       logttprob_lJ = bookH("logttprob_lJ", 20, -20, 0, "logttprob_lJ", logttprobstr, dsigdy(logttprobstr, "1"));
 
       njets_lJJ = bookH("njets_lJJ", 21, -0.5, 20.5, "njets_lJJ", "jet multiplicity", dsigdy(nstr, "1"));
@@ -334,271 +220,383 @@ namespace Rivet {
       pttt_ssJ = bookH("pttt_ssJ", 25, 0, 1, "pttt_ssJ", ptttstr + " [TeV]", dsigdy(ptttstr, "\\mathrm{TeV}"));
       mtt_ssJ = bookH("mtt_ssJ", 15, 0, 3, "mtt_ssJ", "$tt$ invariant mass [TeV]", dsigdy(mttstr, "\\mathrm{TeV}"));
 
+      // which parts of the reconstruction the booked histograms need.
+      needtoptags = ntopbjets || ntopbjets_JJ || ntopbjets_lJ || ntopbjets_lJJ || ntopbjets_ssJ;
+
+      needaddjets_JJ = naddjets_JJ || naddbjets_JJ || naddljets_JJ
+        || booked(chi2_JJ) || logttprob_JJ;
+
+      needaddjets_lJ = naddjets_lJ || naddbjets_lJ || naddljets_lJ
+        || ptth_lJ || pttl_lJ || mth_lJ || mtl_lJ || dphitt_lJ || pttt_lJ || mtt_lJ
+        || booked(chi2_lJ) || logttprob_lJ;
+
+      needaddjets_lJJ = naddjets_lJJ || naddbjets_lJJ || naddljets_lJJ;
+
+      needaddjets_ssJ = naddjets_ssJ || naddbjets_ssJ || naddljets_ssJ
+        || ptth_ssJ || pttl_ssJ || mth_ssJ || mtl_ssJ || dphitt_ssJ || pttt_ssJ || mtt_ssJ;
+
+      doJJ = needaddjets_JJ || njets_JJ || ncentjets_JJ || nfwdjets_JJ || ntopjets_JJ
+        || ntopbjets_JJ || ptth1_JJ || ptth2_JJ || mth1_JJ || mth2_JJ
+        || dphitt_JJ || pttt_JJ || mtt_JJ;
+
+      dolJ = needaddjets_lJ || njets_lJ || ncentjets_lJ || nfwdjets_lJ || ntopjets_lJ
+        || ntopbjets_lJ || ptl1_lJ;
+
+      dolJJ = needaddjets_lJJ || njets_lJJ || ncentjets_lJJ || nfwdjets_lJJ || ntopjets_lJJ
+        || ntopbjets_lJJ || ptl1_lJJ || ptth1_lJJ || ptth2_lJJ || mth1_lJJ || mth2_lJJ
+        || dphitt_lJJ || pttt_lJJ || mtt_lJJ;
+
+      dossJ = needaddjets_ssJ || njets_ssJ || ncentjets_ssJ || nfwdjets_ssJ || ntopjets_ssJ
+        || ntopbjets_ssJ || ptl1_ssJ || ptl2_ssJ;
+
+      checkpoint.configure(cfg, name());
+      checkpoint.restore();
+
     }
 
+    /// Books @a path, or returns a null pointer if it is disabled.
     Histo1DPtr bookH(const string& path, double nb, double bmin, double bmax
         , const string& title, const string& xlabel, const string& ylabel) {
+      if (!wanted(path)) {
+        MSG_DEBUG("not booking disabled histogram " << path);
+        return Histo1DPtr();
+      }
+
       Histo1DPtr h = bookHisto1D(path, nb, bmin, bmax, title, xlabel, ylabel);
       allHists.push_back(h);
+      checkpoint.add(h);
       return h;
     }
 
-    Jets additionalJets(const Jets& jets, const Jets& topjets) {
-      Jets addjets;
+    /// All whitespace-separated patterns given for @a key.
+    static vector<string> patterns(const ConfigFile& cfg, const string& key) {
+      vector<string> ps;
+      for (const string& val : cfg.getAll(key)) {
+        std::istringstream ss(val);
+        string p;
+        while (ss >> p)
+          ps.push_back(p);
+      }
 
-      for (const Jet& j : jets) {
-        const FourMomentum mom = j.mom();
-        bool pass = true;
+      return ps;
+    }
 
-        // soft jets should not be removed, since they are likely to
-        // come from the spectators.
-        if (j.pt() < 60*GeV) {
-          addjets.push_back(j);
-          continue;
-        }
+    bool wanted(const string& path) const {
+      bool enable = enabled.empty();
+      for (const string& p : enabled)
+        if (fnmatch(p.c_str(), path.c_str(), 0) == 0)
+          enable = true;
 
-        for (const Jet& fj : topjets) {
-          if (deltaR(fj.mom(), mom) > 1.2)
-            continue;
+      for (const string& p : disabled)
+        if (fnmatch(p.c_str(), path.c_str(), 0) == 0)
+          enable = false;
 
-          pass = false;
-          break;
-        }
+      return enable;
+    }
 
-        if (pass)
-          addjets.push_back(j);
-      }
+    /// Read the chi2_hadhad hypothesis grid.
+    void configureMassHypotheses(const ConfigFile& cfg) {
+      masshyps = MassHypotheses();
+      masshyps.sigw = cfg.get<double>("chi2_sigw", default_sigw);
+      masshyps.sig_mt_mw = cfg.get<double>("chi2_sig_mt_mw", default_sig_mt_mw);
+
+      const vector<double> mws = massScan(cfg, "chi2_mw", default_mw);
+      const vector<double> mt_mws = massScan(cfg, "chi2_mt_mw", default_mt_mw);
+      for (double m_w : mws)
+        for (double m_t_mw : mt_mws)
+          masshyps.add(m_w, m_t_mw);
+
+      return;
+    }
+
+    /// n equally spaced masses from "<key> = <n> <first> <last>", in GeV
+    /// like everything in TopReco.
+    vector<double> massScan(const ConfigFile& cfg, const string& key, double def) {
+      if (!cfg.has(key))
+        return vector<double>(1, def);
 
-      return addjets;
+      size_t n;
+      double first, last;
+      std::istringstream ss(cfg.getAll(key).back());
+      ss >> n >> first >> last;
+      if (!ss || n == 0)
+        throw UserError("TTTT: expected '" + key + " = <n> <first> <last>'");
+
+      vector<double> ms;
+      for (size_t i = 0; i < n; i++)
+        ms.push_back(n == 1 ? first : first + i*(last-first)/(n-1));
+
+      return ms;
     }
 
+    /// One chi2 histogram per mass hypothesis.
+    vector<Histo1DPtr> bookChi2(const string& path) {
+      vector<Histo1DPtr> hs;
+      if (masshyps.size() == 1) {
+        hs.push_back(bookH(path, 20, 0, 1000, path, chi2str, dsigdy(chi2str, "1")));
+        return hs;
+      }
 
-    Jets btaggedJets(const Jets& jets) {
-      Jets bjets;
-      for (const Jet& j : jets) {
-        // only can tag b-hadrons in the tracker fiducial volume.
-        if (j.bTagged(Cuts::pT > 5*GeV && Cuts::abseta < 2.5))
-          bjets.push_back(j);
+      for (size_t h = 0; h < masshyps.size(); h++) {
+        const string hpath = path + "_h" + to_str(h);
+        const string title = hpath + ": $m_W = " + to_str(masshyps.mw[h])
+          + "$ GeV, $m_t - m_W = " + to_str(masshyps.mt_mw[h]) + "$ GeV";
+        hs.push_back(bookH(hpath, 20, 0, 1000, title, chi2str, dsigdy(chi2str, "1")));
       }
 
-      return bjets;
+      return hs;
+    }
+
+
+    /// The jets not overlapping with the first @a ntop top jets, from the
+    /// four-momenta converted at the start of the event: their indices
+    /// into jets go to addidx and their four-momenta to addp4s.  Returns
+    /// their b-tags, taken from @a jetsmask.
+    TagMask additionalJets(TagMask jetsmask, size_t ntop) {
+      TagMask addmask;
+      addidx.clear();
+      Rivet::additionalJets(jetp4s.data(), jetp4s.size(), jetsmask, topp4s.data(), ntop, addidx, addmask);
+
+      addp4s.clear();
+      for (size_t i : addidx)
+        addp4s.push_back(jetp4s[i]);
+
+      return addmask;
     }
 
 
     /// Perform the per-event analysis
     void analyze(const Event& event) {
 
-      const Particles& leps = apply<PromptFinalState>(event, "PromptLeptons").particles();
-      const Jets& jets = apply<FastJets>(event, "Jets").jetsByPt(Cuts::pT > 25*GeV);
-      const Jets& centjets =
-        apply<FastJets>(event, "Jets").jetsByPt(Cuts::pT > 25*GeV && Cuts::abseta < 2.5);
-      const Jets& fwdjets =
-        apply<FastJets>(event, "Jets").jetsByPt(Cuts::pT > 25*GeV && Cuts::abseta > 2.5);
+      // already processed before a restart
+      if (!checkpoint.accept(event.weight()))
+        return;
+
+      const TopObjects& objects = apply<TopObjects>(event, "Objects");
+      const Particles& leps = objects.leptons();
+      const Jets& jets = objects.jets();
+      const Jets& centjets = objects.jetsByPt(centjetcut);
+      const Jets& fwdjets = objects.jetsByPt(fwdjetcut);
       const Jets& topjets =
-        apply<FastJets>(event, "FatJets").jetsByPt(Cuts::pT > 300*GeV && Cuts::abseta < 2.0 && Cuts::mass > 100*GeV);
+        apply<FastJets>(event, "FatJets").jetsByPt(topjetcut);
 
-      double weight = event.weight();
+      // every b-tag decision of the event is made here, once per jet;
+      // the small-R ones already in TopObjects.
+      const TagMask jetsmask = objects.bmask();
+      const TagMask topmask = needtoptags ? objects.btagger().mask(topjets) : 0;
 
-      nleps->fill(leps.size(), weight);
-      njets->fill(jets.size(), weight);
-      nbjets->fill(btaggedJets(jets).size(), weight);
-      ncentjets->fill(centjets.size(), weight);
-      nfwdjets->fill(fwdjets.size(), weight);
-      ntopjets->fill(topjets.size(), weight);
-      ntopbjets->fill(btaggedJets(topjets).size(), weight);
-
-
-      if (leps.size() == 0 && topjets.size() >= 2) {
-        njets_JJ->fill(jets.size(), weight);
-        ncentjets_JJ->fill(centjets.size(), weight);
-        nfwdjets_JJ->fill(fwdjets.size(), weight);
-        ntopjets_JJ->fill(topjets.size(), weight);
-
-        ptth1_JJ->fill(topjets[0].pt()/TeV, weight);
-        ptth2_JJ->fill(topjets[1].pt()/TeV, weight);
-        mth1_JJ->fill(topjets[0].mass()/GeV, weight);
-        mth2_JJ->fill(topjets[1].mass()/GeV, weight);
-
-        Jets goodtopjets;
-        goodtopjets.push_back(topjets[0]);
-        goodtopjets.push_back(topjets[1]);
-        ntopbjets_JJ->fill(btaggedJets(goodtopjets).size(), weight);
-
-        Jets addjets = additionalJets(jets, goodtopjets);
-        naddjets_JJ->fill(addjets.size(), weight);
-        Jets addbjets = btaggedJets(addjets);
-        naddbjets_JJ->fill(addbjets.size(), weight);
-        naddljets_JJ->fill(addjets.size()-addbjets.size(), weight);
-
-        FourMomentum t1 = goodtopjets[0].mom();
-        FourMomentum t2 = goodtopjets[1].mom();
-        FourMomentum tt = t1 + t2;
+      // converted once for all the reconstruction kernels below.
+      jetP4s(jets, jetp4s);
+      jetP4s(topjets, topp4s);
 
-        mth1_JJ->fill(t1.mass()/GeV, weight);
-        mth2_JJ->fill(t2.mass()/GeV, weight);
+      double weight = event.weight();
 
-        dphitt_JJ->fill(abs(deltaPhi(t1, t2)), weight);
+      fill(nleps, leps.size(), weight);
+      fill(njets, jets.size(), weight);
+      fill(nbjets, countTags(jetsmask), weight);
+      fill(ncentjets, centjets.size(), weight);
+      fill(nfwdjets, fwdjets.size(), weight);
+      fill(ntopjets, topjets.size(), weight);
+      fill(ntopbjets, countTags(topmask), weight);
 
-        pttt_JJ->fill(tt.pt()/TeV, weight);
-        mtt_JJ->fill(tt.mass()/TeV, weight);
 
+      if (doJJ && leps.size() == 0 && topjets.size() >= 2) {
+        fill(njets_JJ, jets.size(), weight);
+        fill(ncentjets_JJ, centjets.size(), weight);
+        fill(nfwdjets_JJ, fwdjets.size(), weight);
+        fill(ntopjets_JJ, topjets.size(), weight);
 
-        if (addjets.size() >= 6)
-          chi2_JJ->fill(chi2_hadhad(addjets), weight);
+        fill(ptth1_JJ, topjets[0].pt()/TeV, weight);
+        fill(ptth2_JJ, topjets[1].pt()/TeV, weight);
+        fill(mth1_JJ, topjets[0].mass()/GeV, weight);
+        fill(mth2_JJ, topjets[1].mass()/GeV, weight);
 
-        if (addjets.size() >= 4)
-          logttprob_JJ->fill(log(ttProb(topPDF0b, topPDF1b, addjets)), weight);
+        fill(ntopbjets_JJ, countTags(topmask & firstJets(2)), weight);
 
-      } if (leps.size() == 1 && topjets.size() == 1) {
-        njets_lJ->fill(jets.size(), weight);
-        ncentjets_lJ->fill(centjets.size(), weight);
-        nfwdjets_lJ->fill(fwdjets.size(), weight);
-        ntopjets_lJ->fill(topjets.size(), weight);
-        ptl1_lJ->fill(leps[0].pt()/GeV, weight);
+        FourMomentum t1 = topjets[0].mom();
+        FourMomentum t2 = topjets[1].mom();
+        FourMomentum tt = t1 + t2;
 
-        Jets goodtopjets = topjets;
-        ntopbjets_lJ->fill(btaggedJets(goodtopjets).size(), weight);
+        fill(mth1_JJ, t1.mass()/GeV, weight);
+        fill(mth2_JJ, t2.mass()/GeV, weight);
 
-        Jets addjetstmp = additionalJets(jets, goodtopjets);
+        fill(dphitt_JJ, abs(deltaPhi(t1, t2)), weight);
 
-        // look for the closest b-tagged jet to the lepton.
-        // assume this is coming from the leptonically decaying top
-        // quark from the resonance.
-        double drmin = -1;
-        int drmin_idx = -1;
-        for (size_t i = 0; i < addjetstmp.size(); i++) {
-          const Jet& j = addjetstmp[i];
+        fill(pttt_JJ, tt.pt()/TeV, weight);
+        fill(mtt_JJ, tt.mass()/TeV, weight);
 
-          if (!j.bTagged(Cuts::pT > 5*GeV && Cuts::abseta < 2.5))
-            continue;
+        if (needaddjets_JJ) {
+          TagMask addmask = additionalJets(jetsmask, 2);
+          fill(naddjets_JJ, addp4s.size(), weight);
+          size_t naddbjets = countTags(addmask);
+          fill(naddbjets_JJ, naddbjets, weight);
+          fill(naddljets_JJ, addp4s.size()-naddbjets, weight);
 
-          double dr = deltaR(leps[0].mom(), j.mom());
-          if (drmin_idx < 0 || dr < drmin) {
-            drmin = dr;
-            drmin_idx = i;
+          if (booked(chi2_JJ) && addp4s.size() >= 6) {
+            chi2_hadhad(addp4s.data(), addp4s.size(), masshyps, minchi2s);
+            for (size_t h = 0; h < minchi2s.size(); h++)
+              fill(chi2_JJ[h], minchi2s[h], weight);
           }
+
+          if (logttprob_JJ && addp4s.size() >= 4)
+            fill(logttprob_JJ, log(ttProb(topPDF0b, topPDF1b, addp4s.data(), addp4s.size(), addmask)), weight);
         }
 
-        if (drmin_idx >= 0) {
-          const Jet& bestjet = addjetstmp[drmin_idx].mom();
+      } if (dolJ && leps.size() == 1 && topjets.size() == 1) {
+        fill(njets_lJ, jets.size(), weight);
+        fill(ncentjets_lJ, centjets.size(), weight);
+        fill(nfwdjets_lJ, fwdjets.size(), weight);
+        fill(ntopjets_lJ, topjets.size(), weight);
+        fill(ptl1_lJ, leps[0].pt()/GeV, weight);
+
+        fill(ntopbjets_lJ, countTags(topmask), weight);
+
+        if (needaddjets_lJ) {
+          TagMask addmasktmp = additionalJets(jetsmask, topjets.size());
+
+          // look for the closest b-tagged jet to the lepton.
+          // assume this is coming from the leptonically decaying top
+          // quark from the resonance.
+          double drmin = -1;
+          int drmin_idx = -1;
+          for (size_t i = 0; i < addidx.size(); i++) {
+            const Jet& j = jets[addidx[i]];
+
+            if (!isTagged(addmasktmp, i))
+              continue;
+
+            double dr = deltaR(leps[0].mom(), j.mom());
+            if (drmin_idx < 0 || dr < drmin) {
+              drmin = dr;
+              drmin_idx = i;
+            }
+          }
+
+          if (drmin_idx >= 0) {
+            const FourMomentum& bestjet = jets[addidx[drmin_idx]].mom();
 
-          Jets addjets;
-          for (size_t i = 0; i < addjetstmp.size(); i++)
-            if (i != drmin_idx)
-              addjets.push_back(addjetstmp[i]);
+            addp4s.erase(addp4s.begin() + drmin_idx);
+            TagMask addmask = dropJet(addmasktmp, drmin_idx);
 
 
-          naddjets_lJ->fill(addjets.size(), weight);
+            fill(naddjets_lJ, addp4s.size(), weight);
 
-          Jets addbjets = btaggedJets(addjets);
-          naddbjets_lJ->fill(addbjets.size(), weight);
-          naddljets_lJ->fill(addjets.size()-addbjets.size(), weight);
+            size_t naddbjets = countTags(addmask);
+            fill(naddbjets_lJ, naddbjets, weight);
+            fill(naddljets_lJ, addp4s.size()-naddbjets, weight);
 
 
-          // colinear approximation
-          FourMomentum tl = leps[0].mom() + leps[0].mom() + bestjet;
-          FourMomentum th = goodtopjets[0].mom();
-          FourMomentum tt = tl + th;
+            // colinear approximation
+            FourMomentum tl = leps[0].mom() + leps[0].mom() + bestjet;
+            FourMomentum th = topjets[0].mom();
+            FourMomentum tt = tl + th;
 
-          ptth_lJ->fill(th.pt()/TeV, weight);
-          pttl_lJ->fill(tl.pt()/TeV, weight);
+            fill(ptth_lJ, th.pt()/TeV, weight);
+            fill(pttl_lJ, tl.pt()/TeV, weight);
 
-          mtl_lJ->fill(tl.mass()/GeV, weight);
-          mth_lJ->fill(th.mass()/GeV, weight);
+            fill(mtl_lJ, tl.mass()/GeV, weight);
+            fill(mth_lJ, th.mass()/GeV, weight);
 
-          dphitt_lJ->fill(abs(deltaPhi(tl, th)), weight);
+            fill(dphitt_lJ, abs(deltaPhi(tl, th)), weight);
 
-          pttt_lJ->fill(tt.pt()/TeV, weight);
-          mtt_lJ->fill(tt.mass()/TeV, weight);
+            fill(pttt_lJ, tt.pt()/TeV, weight);
+            fill(mtt_lJ, tt.mass()/TeV, weight);
 
-          if (addjets.size() >= 6)
-            chi2_lJ->fill(chi2_hadhad(addjets), weight);
+            if (booked(chi2_lJ) && addp4s.size() >= 6) {
+              chi2_hadhad(addp4s.data(), addp4s.size(), masshyps, minchi2s);
+              for (size_t h = 0; h < minchi2s.size(); h++)
+                fill(chi2_lJ[h], minchi2s[h], weight);
+            }
 
-          if (addjets.size() >= 4)
-            logttprob_lJ->fill(log(ttProb(topPDF0b, topPDF1b, addjets)), weight);
+            if (logttprob_lJ && addp4s.size() >= 4)
+              fill(logttprob_lJ, log(ttProb(topPDF0b, topPDF1b, addp4s.data(), addp4s.size(), addmask)), weight);
+          }
         }
 
-      } else if (leps.size() == 1 && topjets.size() >= 2) {
-        njets_lJJ->fill(jets.size(), weight);
-        ncentjets_lJJ->fill(centjets.size(), weight);
-        nfwdjets_lJJ->fill(fwdjets.size(), weight);
-        ntopjets_lJJ->fill(topjets.size(), weight);
+      } else if (dolJJ && leps.size() == 1 && topjets.size() >= 2) {
+        fill(njets_lJJ, jets.size(), weight);
+        fill(ncentjets_lJJ, centjets.size(), weight);
+        fill(nfwdjets_lJJ, fwdjets.size(), weight);
+        fill(ntopjets_lJJ, topjets.size(), weight);
 
-        ptth1_lJJ->fill(topjets[0].pt()/TeV, weight);
-        ptth2_lJJ->fill(topjets[1].pt()/TeV, weight);
-        mth1_lJJ->fill(topjets[0].mass()/GeV, weight);
-        mth2_lJJ->fill(topjets[1].mass()/GeV, weight);
-        ptl1_lJJ->fill(leps[0].pt()/GeV, weight);
+        fill(ptth1_lJJ, topjets[0].pt()/TeV, weight);
+        fill(ptth2_lJJ, topjets[1].pt()/TeV, weight);
+        fill(mth1_lJJ, topjets[0].mass()/GeV, weight);
+        fill(mth2_lJJ, topjets[1].mass()/GeV, weight);
+        fill(ptl1_lJJ, leps[0].pt()/GeV, weight);
 
-        Jets goodtopjets;
-        goodtopjets.push_back(topjets[0]);
-        goodtopjets.push_back(topjets[1]);
-        ntopbjets_lJJ->fill(btaggedJets(goodtopjets).size(), weight);
+        fill(ntopbjets_lJJ, countTags(topmask & firstJets(2)), weight);
 
-        Jets addjets = additionalJets(jets, goodtopjets);
-        naddjets_lJJ->fill(addjets.size(), weight);
+        if (needaddjets_lJJ) {
+          TagMask addmask = additionalJets(jetsmask, 2);
+          fill(naddjets_lJJ, addidx.size(), weight);
 
-        Jets addbjets = btaggedJets(addjets);
-        naddbjets_lJJ->fill(addbjets.size(), weight);
-        naddljets_lJJ->fill(addjets.size()-addbjets.size(), weight);
+          size_t naddbjets = countTags(addmask);
+          fill(naddbjets_lJJ, naddbjets, weight);
+          fill(naddljets_lJJ, addidx.size()-naddbjets, weight);
+        }
 
-        FourMomentum t1 = goodtopjets[0].mom();
-        FourMomentum t2 = goodtopjets[1].mom();
+        FourMomentum t1 = topjets[0].mom();
+        FourMomentum t2 = topjets[1].mom();
         FourMomentum tt = t1 + t2;
 
-        mth1_lJJ->fill(t1.mass()/GeV, weight);
-        mth2_lJJ->fill(t2.mass()/GeV, weight);
+        fill(mth1_lJJ, t1.mass()/GeV, weight);
+        fill(mth2_lJJ, t2.mass()/GeV, weight);
 
-        dphitt_lJJ->fill(abs(deltaPhi(t1, t2)), weight);
+        fill(dphitt_lJJ, abs(deltaPhi(t1, t2)), weight);
 
-        pttt_lJJ->fill(tt.pt()/TeV, weight);
-        mtt_lJJ->fill(tt.mass()/TeV, weight);
+        fill(pttt_lJJ, tt.pt()/TeV, weight);
+        fill(mtt_lJJ, tt.mass()/TeV, weight);
 
-      } else if (leps.size() == 2 && topjets.size() >= 1 && leps[0].threeCharge()*leps[1].threeCharge() > 0 ) {
-        njets_ssJ->fill(jets.size(), weight);
-        ncentjets_ssJ->fill(centjets.size(), weight);
-        nfwdjets_ssJ->fill(fwdjets.size(), weight);
-        ntopjets_ssJ->fill(topjets.size(), weight);
-        ptl1_ssJ->fill(leps[0].pt()/GeV, weight);
-        ptl2_ssJ->fill(leps[1].pt()/GeV, weight);
+      } else if (dossJ && leps.size() == 2 && topjets.size() >= 1 && leps[0].threeCharge()*leps[1].threeCharge() > 0 ) {
+        fill(njets_ssJ, jets.size(), weight);
+        fill(ncentjets_ssJ, centjets.size(), weight);
+        fill(nfwdjets_ssJ, fwdjets.size(), weight);
+        fill(ntopjets_ssJ, topjets.size(), weight);
+        fill(ptl1_ssJ, leps[0].pt()/GeV, weight);
+        fill(ptl2_ssJ, leps[1].pt()/GeV, weight);
 
-        Jets goodtopjets;
-        goodtopjets.push_back(topjets[0]);
-        ntopbjets_ssJ->fill(btaggedJets(goodtopjets).size(), weight);
+        fill(ntopbjets_ssJ, countTags(topmask & firstJets(1)), weight);
 
-        Jets addjets = additionalJets(jets, goodtopjets);
-        naddjets_ssJ->fill(addjets.size(), weight);
+        if (needaddjets_ssJ) {
+          TagMask addmask = additionalJets(jetsmask, 1);
+          fill(naddjets_ssJ, addidx.size(), weight);
 
-        Jets addbjets = btaggedJets(addjets);
-        naddbjets_ssJ->fill(addbjets.size(), weight);
-        naddljets_ssJ->fill(addjets.size()-addbjets.size(), weight);
+          size_t naddbjets = countTags(addmask);
+          fill(naddbjets_ssJ, naddbjets, weight);
+          fill(naddljets_ssJ, addidx.size()-naddbjets, weight);
 
-        const Jet* bestjet = NULL;
-        double drmin = -1;
-        for (const Jet& j : addbjets) {
-          double dr = deltaR(leps[0].mom(), j.mom());
-          if (drmin < 0 || dr < drmin) {
-            bestjet = &j;
-            drmin = dr;
+          const Jet* bestjet = NULL;
+          double drmin = -1;
+          for (size_t i = 0; i < addidx.size(); i++) {
+            if (!isTagged(addmask, i))
+              continue;
+
+            const Jet& j = jets[addidx[i]];
+            double dr = deltaR(leps[0].mom(), j.mom());
+            if (drmin < 0 || dr < drmin) {
+              bestjet = &j;
+              drmin = dr;
+            }
           }
-        }
 
-        if (drmin >= 0) {
-          // colinear approximation
-          FourMomentum tl = leps[0].mom() + leps[0].mom() + bestjet->mom();
-          FourMomentum th = goodtopjets[0].mom();
-          FourMomentum tt = tl + th;
+          if (drmin >= 0) {
+            // colinear approximation
+            FourMomentum tl = leps[0].mom() + leps[0].mom() + bestjet->mom();
+            FourMomentum th = topjets[0].mom();
+            FourMomentum tt = tl + th;
 
-          pttl_ssJ->fill(tl.pt()/TeV, weight);
-          ptth_ssJ->fill(th.pt()/TeV, weight);
+            fill(pttl_ssJ, tl.pt()/TeV, weight);
+            fill(ptth_ssJ, th.pt()/TeV, weight);
 
-          mtl_ssJ->fill(tl.mass()/GeV, weight);
-          mth_ssJ->fill(th.mass()/GeV, weight);
+            fill(mtl_ssJ, tl.mass()/GeV, weight);
+            fill(mth_ssJ, th.mass()/GeV, weight);
 
-          dphitt_ssJ->fill(abs(deltaPhi(tl, th)), weight);
+            fill(dphitt_ssJ, abs(deltaPhi(tl, th)), weight);
 
-          pttt_ssJ->fill(tt.pt()/TeV, weight);
-          mtt_ssJ->fill(tt.mass()/TeV, weight);
+            fill(pttt_ssJ, tt.pt()/TeV, weight);
+            fill(mtt_ssJ, tt.mass()/TeV, weight);
+          }
         }
 
       }
@@ -609,17 +607,16 @@ namespace Rivet {
 
     /// Normalise histograms etc., after the run
     void finalize() {
-      const string onebysig = "\\ensuremath{\\frac{1}{\\sigma}}";
+      checkpoint.wait();
 
+      // Rivet's sum of weights does not include events from before a restart.
+      const double sumw = checkpoint.sumOfWeights();
 
+      // the _norm copies and the SumW/CrossSection annotations are
+      // reproduced by ttttmerge when merging job outputs: keep them in sync.
       for (Histo1DPtr& h : allHists) {
-        Histo1DPtr hnorm = make_shared<Histo1D>(*h);
-        normalize(hnorm);
-        hnorm->setPath(hnorm->path() + "_norm");
-        hnorm->setAnnotation("YLabel", onebysig + replace(hnorm->annotation("YLabel"), "pb", "1"));
-        addAnalysisObject(hnorm);
-
-        scale(h, crossSection()/sumOfWeights());
+        addAnalysisObject(normalisedCopy(*h));
+        scaleToCrossSection(*h, crossSection(), sumw);
       }
 
       return;
@@ -654,7 +651,7 @@ namespace Rivet {
     Histo1DPtr dphitt_JJ;
     Histo1DPtr pttt_JJ;
     Histo1DPtr mtt_JJ;
-    Histo1DPtr chi2_JJ;
+    vector<Histo1DPtr> chi2_JJ;
     Histo1DPtr logttprob_JJ;
 
     Histo1DPtr njets_lJ;
@@ -674,7 +671,7 @@ namespace Rivet {
     Histo1DPtr dphitt_lJ;
     Histo1DPtr pttt_lJ;
     Histo1DPtr mtt_lJ;
-    Histo1DPtr chi2_lJ;
+    vector<Histo1DPtr> chi2_lJ;
     Histo1DPtr logttprob_lJ;
 
     Histo1DPtr njets_lJJ;
@@ -716,10 +713,27 @@ namespace Rivet {
 
     vector<Histo1DPtr> allHists;
 
-    Histo2D topPDF0b;
-    Histo2D topPDF1b;
+    TopTemplate topPDF0b;
+    TopTemplate topPDF1b;
     //@}
 
+    MassHypotheses masshyps;
+    vector<double> minchi2s;
+
+    // per-event scratch for the reconstruction kernels, kept as members
+    // so that their capacity is reused.
+    vector<JetP4> jetp4s, topp4s, addp4s;
+    vector<size_t> addidx;
+
+    Cut centjetcut, fwdjetcut, topjetcut;
+
+    vector<string> enabled, disabled;
+    bool needtoptags;
+    bool needaddjets_JJ, needaddjets_lJ, needaddjets_lJJ, needaddjets_ssJ;
+    bool doJJ, dolJ, dolJJ, dossJ;
+
+    Checkpoint checkpoint;
+
 
   };
 
@@ -0,0 +1,21 @@
+import subprocess
+from setuptools import setup, Extension
+
+import numpy
+
+
+def yoda_config(*args):
+  return subprocess.check_output(["yoda-config"] + list(args)).decode().split()
+
+
+ttttreco = \
+  Extension(
+    "ttttreco"
+  , ["python/ttttreco.cc"]
+  , include_dirs = [numpy.get_include()]
+  , extra_compile_args = ["-std=c++11", "-O3", "-pthread"] + yoda_config("--cppflags")
+  , extra_link_args = ["-pthread"] + yoda_config("--libs")
+  )
+
+
+setup(name = "ttttreco", version = "0.1", ext_modules = [ttttreco])
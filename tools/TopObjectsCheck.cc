@@ -0,0 +1,67 @@
+// -*- C++ -*-
+#include "Rivet/Analysis.hh"
+#include "../common/TopObjects.hh"
+
+namespace Rivet {
+
+  /// @brief Check that TopObjects is projected once per event
+  ///
+  /// Declares the same TopObjects as TTTT and HadTop, applies it in every
+  /// event and compares TopObjects::numProjections() with the number of
+  /// events in finalize.  Run it together with the other analyses, built
+  /// into the same plugin library so that they share the counter; if any
+  /// of the declarations stopped being equivalent, the jets would be
+  /// clustered more than once per event and finalize throws.
+  ///
+  /// See tools/check-shared-projection.sh.
+  class TopObjectsCheck : public Analysis {
+  public:
+
+    /// Constructor
+    DEFAULT_RIVET_ANALYSIS_CTOR(TopObjectsCheck);
+
+
+    /// @name Analysis methods
+    //@{
+
+    void init() {
+      declare(TopObjects(), "Objects");
+      nevents = 0;
+      first = TopObjects::numProjections();
+      return;
+    }
+
+
+    void analyze(const Event& event) {
+      apply<TopObjects>(event, "Objects");
+      nevents++;
+      return;
+    }
+
+
+    void finalize() {
+      const size_t nproj = TopObjects::numProjections() - first;
+      MSG_INFO("TopObjects projected " << nproj << " times in " << nevents << " events");
+
+      if (nproj != nevents)
+        throw Error("TopObjectsCheck: TopObjects was projected " + to_str(nproj)
+            + " times for " + to_str(nevents) + " events");
+
+      return;
+    }
+
+    //@}
+
+
+  private:
+
+    size_t nevents, first;
+
+  };
+
+
+  // The hook for the plugin system
+  DECLARE_RIVET_PLUGIN(TopObjectsCheck);
+
+
+}
@@ -0,0 +1,39 @@
+#!/bin/bash
+#
+# Check that TTTT and HadTop share one TopObjects projection: build both
+# together with the TopObjectsCheck analysis into a single plugin library,
+# so that they share TopObjects::numProjections(), and run all three on a
+# sample.  TopObjectsCheck fails the run in finalize unless TopObjects was
+# projected (i.e. the R=0.4 jets clustered and b-tagged) exactly once per
+# event; if the declarations stopped comparing equal the count would double.
+#
+# usage
+#   tools/check-shared-projection.sh [sample.hepmc]
+#
+# The sample defaults to tools/check-sample.hepmc (written by
+# tools/make-check-sample.py).  Needs rivet and rivet-buildplugin (Rivet 2)
+# in PATH.
+
+set -e
+
+top=$(cd "$(dirname "$0")/.." && pwd -P)
+sample=${1:-$top/tools/check-sample.hepmc}
+sample=$(cd "$(dirname "$sample")" && pwd -P)/$(basename "$sample")
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+
+# one library, so that all three see the same counter
+rivet-buildplugin RivetTopObjectsCheck.so "$top/rivet/TTTT.cc" \
+  "$top/hadtop/HadTop.cc" "$top/tools/TopObjectsCheck.cc"
+
+# TTTT reads its top templates from the working directory.
+cp "$top/rivet/toptemplate.yoda" "$top/tools/TopObjectsCheck.info" .
+
+rivet --pwd -a TTTT -a HadTop -a TopObjectsCheck -H out.yoda "$sample" \
+  > rivet.log 2>&1 \
+  || { cat rivet.log >&2; echo "FAIL: rivet exited with an error" >&2; exit 1; }
+
+grep 'TopObjects projected' rivet.log
+echo "OK: TopObjects projected once per event"
@@ -0,0 +1,162 @@
+"""Write tools/check-sample.hepmc, the toy sample for check-shared-projection.sh.
+
+Ten HepMC2 (IO_GenEvent) tt events: g g -> t tbar with a marked signal
+vertex, t -> W b with hadronic or leptonic W decays, and a little beam
+radiation.  Every quark or gluon becomes three collinear pions.  The
+kinematics are toy-level (no energy-momentum conservation at the beams);
+the sample only has to exercise the lepton, jet and truth projections.
+
+usage
+  python tools/make-check-sample.py [output.hepmc]
+"""
+
+import math
+import os
+import random
+import sys
+
+
+MT, MW, MB, MPI = 172.5, 80.4, 4.8, 0.13957
+EBEAM = 6500.0
+NEVT = 10
+
+rng = random.Random(20261019)
+
+
+def p4(px, py, pz, m):
+  return [px, py, pz, math.sqrt(px*px + py*py + pz*pz + m*m)]
+
+
+def mass(p):
+  return math.sqrt(max(p[3]**2 - p[0]**2 - p[1]**2 - p[2]**2, 0))
+
+
+def boost(p, b):
+  b2 = sum(x*x for x in b)
+  if b2 == 0:
+    return p[:]
+
+  g = 1 / math.sqrt(1 - b2)
+  bp = sum(b[i]*p[i] for i in range(3))
+  g2 = (g - 1) / b2
+  return [p[i] + g2*bp*b[i] + g*b[i]*p[3] for i in range(3)] + [g*(p[3] + bp)]
+
+
+def two_body(parent, m1, m2):
+  """Isotropic decay of parent into masses m1 and m2."""
+  m = mass(parent)
+  pstar = math.sqrt((m*m - (m1 + m2)**2) * (m*m - (m1 - m2)**2)) / (2*m)
+  ct = rng.uniform(-1, 1)
+  st = math.sqrt(1 - ct*ct)
+  phi = rng.uniform(0, 2*math.pi)
+  d = [pstar*st*math.cos(phi), pstar*st*math.sin(phi), pstar*ct]
+  b = [parent[i] / parent[3] for i in range(3)]
+  return boost(p4(d[0], d[1], d[2], m1), b), boost(p4(-d[0], -d[1], -d[2], m2), b)
+
+
+class Event(object):
+
+  def __init__(self):
+    self.vertices = []  # [barcode, orphan incoming particles, outgoing particles]
+    self.pbarcode = 0
+
+  def vertex(self):
+    v = [-len(self.vertices) - 1, [], []]
+    self.vertices.append(v)
+    return v
+
+  def particle(self, pid, p, status, end=None):
+    self.pbarcode += 1
+    return [self.pbarcode, pid, p, status, end[0] if end else 0]
+
+
+def hadronise(ev, v, pid, p):
+  """Add parton pid to v, decaying into three collinear pions."""
+  hv = ev.vertex()
+  v[2].append(ev.particle(pid, p, 2, hv))
+  for f, pion in ((0.5, 211), (0.3, -211), (0.2, 111)):
+    hv[2].append(ev.particle(pion, p4(f*p[0], f*p[1], f*p[2], MPI), 1))
+
+
+def top_decay(ev, top, sign, leptonic):
+  tv = ev.vertex()
+  top[4] = tv[0]
+  w, b = two_body(top[2], MW, MB)
+
+  wv = ev.vertex()
+  tv[2].append(ev.particle(24*sign, w, 22, wv))
+  hadronise(ev, tv, 5*sign, b)
+
+  if leptonic:
+    l, nu = two_body(w, 0.000511, 0)
+    wv[2].append(ev.particle(-11*sign, l, 1))
+    wv[2].append(ev.particle(12*sign, nu, 1))
+  else:
+    q1, q2 = two_body(w, 0.3, 0.3)
+    hadronise(ev, wv, 2*sign, q1)
+    hadronise(ev, wv, -sign, q2)
+
+
+def event(n):
+  ev = Event()
+  beamv = [ev.vertex(), ev.vertex()]
+  hardv = ev.vertex()
+
+  pt = rng.uniform(50, 700)
+  phi = rng.uniform(0, 2*math.pi)
+  y = rng.uniform(-1.5, 1.5)
+  t = p4(pt*math.cos(phi), pt*math.sin(phi), math.sqrt(pt*pt + MT*MT)*math.sinh(y), MT)
+  tbar = p4(-t[0], -t[1], rng.uniform(-300, 300), MT)
+  e, pz = t[3] + tbar[3], t[2] + tbar[2]
+  xs = [(e + pz) / (2*EBEAM), (e - pz) / (2*EBEAM)]
+
+  for v, x, s in zip(beamv, xs, (1, -1)):
+    v[1].append(ev.particle(2212, [0, 0, s*EBEAM, EBEAM], 4, v))
+    v[2].append(ev.particle(21, [0, 0, s*x*EBEAM, x*EBEAM], 21, hardv))
+    v[2].append(ev.particle(2101, [0, 0, s*0.999*(1 - x)*EBEAM, 0.999*(1 - x)*EBEAM], 1))
+    for _ in range(rng.randint(1, 3)):
+      rpt = rng.uniform(20, 80)
+      rphi = rng.uniform(0, 2*math.pi)
+      reta = rng.uniform(-3, 3)
+      hadronise(ev, v, 21, p4(rpt*math.cos(rphi), rpt*math.sin(rphi), rpt*math.sinh(reta), 0))
+
+  top = ev.particle(6, t, 22)
+  antitop = ev.particle(-6, tbar, 22)
+  hardv[2] += [top, antitop]
+
+  # all-hadronic, single-lepton and dilepton events in turn
+  top_decay(ev, top, 1, n % 3 >= 1)
+  top_decay(ev, antitop, -1, n % 3 == 2)
+  return ev
+
+
+def write(fname):
+  lines = ["", "HepMC::Version 2.06.09", "HepMC::IO_GenEvent-START_EVENT_LISTING"]
+
+  for n in range(NEVT):
+    ev = event(n)
+    # E number nmpi scale alphaQCD alphaQED process signal_vertex nvertices
+    #   beam1 beam2 nrandom nweights weights
+    lines.append("E %d -1 -1.0e+00 -1.0e+00 -1.0e+00 0 %d %d 1 2 0 1 1.0e+00"
+        % (n + 1, ev.vertices[2][0], len(ev.vertices)))
+    lines.append("U GEV MM")
+    lines.append("C 1.0e+00 1.0e-01")
+
+    for barcode, orphans, outgoing in ev.vertices:
+      lines.append("V %d 0 0 0 0 0 %d %d 0" % (barcode, len(orphans), len(outgoing)))
+      for pbarcode, pid, p, status, end in orphans + outgoing:
+        theta = math.atan2(math.hypot(p[0], p[1]), p[2])
+        phi = math.atan2(p[1], p[0])
+        lines.append("P %d %d %.8e %.8e %.8e %.8e %.8e %d %.8e %.8e %d 0"
+            % (pbarcode, pid, p[0], p[1], p[2], p[3], mass(p), status, theta, phi, end))
+
+  lines.append("HepMC::IO_GenEvent-END_EVENT_LISTING")
+  lines.append("")
+
+  with open(fname, "w") as f:
+    f.write("\n".join(lines))
+
+
+if __name__ == "__main__":
+  write(sys.argv[1] if len(sys.argv) > 1
+      else os.path.join(os.path.dirname(os.path.abspath(__file__)), "check-sample.hepmc"))
@@ -0,0 +1,269 @@
+// -*- C++ -*-
+//
+// Merge per-job TTTT outputs.
+//
+// Every job scales its histograms by crossSection()/sumOfWeights() and
+// writes a unit-normalised "_norm" copy, so the outputs cannot simply be
+// added.  ttttmerge reads the inputs in parallel, undoes the per-job
+// scaling using the SumW/CrossSection annotations written by
+// TTTT::finalize, sums the raw weights in a tree reduction across threads,
+// and then applies the cross-section scaling once and rebuilds every _norm
+// histogram exactly as finalize does.
+//
+// The merged file carries the same annotations, so it can be merged again.
+//
+// build with
+//   g++ -std=c++11 -O2 -pthread ttttmerge.cc -o ttttmerge `yoda-config --cppflags --libs`
+//
+// usage
+//   ttttmerge [-j nthreads] -o merged.yoda job1.yoda job2.yoda ...
+//
+// -j sets the number of threads for reading and summing the inputs
+// (default: all cores).  All jobs must have booked the same histograms,
+// i.e. run with the same TTTT_CONFIG enable/disable and chi2 settings.
+
+#include "YODA/ReaderYODA.h"
+#include "YODA/WriterYODA.h"
+#include "YODA/Histo1D.h"
+#include "../common/Normalisation.hh"
+
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace YODA;
+
+namespace {
+
+  const string prefix = "/TTTT/";
+
+
+  bool endsWith(const string& s, const string& suffix) {
+    return s.size() >= suffix.size()
+      && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+  }
+
+
+  /// Raw (unscaled) TTTT histograms and counters of one or more jobs.
+  struct Partial {
+    map<string, Histo1D> hists;
+    double sumw;
+    double xsecsumw;
+
+    Partial() : sumw(0), xsecsumw(0) { }
+
+    /// Jobs must have booked the same histograms: one missing from some
+    /// jobs would be normalised with the sum of weights of all of them.
+    /// Partials without histograms (skipped jobs) add nothing.
+    Partial& operator+=(const Partial& other) {
+      if (hists.empty()) {
+        hists = other.hists;
+      } else if (!other.hists.empty()) {
+        if (hists.size() != other.hists.size())
+          throw runtime_error("the jobs booked different sets of histograms");
+
+        for (const auto& kv : other.hists) {
+          auto it = hists.find(kv.first);
+          if (it == hists.end())
+            throw runtime_error(kv.first + " is not booked in every job");
+          it->second += kv.second;
+        }
+      }
+
+      sumw += other.sumw;
+      xsecsumw += other.xsecsumw;
+      return *this;
+    }
+  };
+
+
+  /// Call f(0) ... f(n-1) on up to nthreads threads.
+  void parallelFor(size_t n, size_t nthreads, const function<void(size_t)>& f) {
+    atomic<size_t> next(0);
+    vector<thread> pool;
+    for (size_t t = 0; t < nthreads && t < n; t++)
+      pool.emplace_back([&]() {
+        for (size_t i = next++; i < n; i = next++)
+          f(i);
+      });
+
+    for (thread& th : pool)
+      th.join();
+
+    return;
+  }
+
+
+  double annotationAsDouble(const Histo1D& h, const string& key, const string& fname) {
+    if (!h.hasAnnotation(key))
+      throw runtime_error(fname + ": " + h.path() + " has no " + key
+          + " annotation; was it produced by an older TTTT?");
+
+    return atof(h.annotation(key).c_str());
+  }
+
+
+  Partial readJob(const string& fname) {
+    Partial part;
+    bool first = true;
+
+    // take ownership straight away so that nothing leaks if we throw.
+    vector<unique_ptr<AnalysisObject> > aos;
+    for (AnalysisObject* ao : ReaderYODA::create().read(fname))
+      aos.emplace_back(ao);
+
+    for (const unique_ptr<AnalysisObject>& ao : aos) {
+      Histo1D* h = dynamic_cast<Histo1D*>(ao.get());
+      if (h && h->path().compare(0, prefix.size(), prefix) == 0 && !endsWith(h->path(), "_norm")) {
+        const double sumw = annotationAsDouble(*h, Rivet::sumwkey, fname);
+        if (sumw == 0) {
+          // TTTT scaled these by 0: there is nothing to undo or add.
+          cerr << "warning: skipping " << fname << ": zero " << Rivet::sumwkey << endl;
+          return Partial();
+        }
+
+        const double xsec = annotationAsDouble(*h, Rivet::xseckey, fname);
+        if (xsec == 0)
+          throw runtime_error(fname + ": zero cross section, cannot undo the scaling");
+
+        if (first) {
+          part.sumw = sumw;
+          part.xsecsumw = xsec*sumw;
+          first = false;
+        } else if (sumw != part.sumw) {
+          throw runtime_error(fname + ": inconsistent " + Rivet::sumwkey + " annotations");
+        }
+
+        h->scaleW(sumw/xsec);
+        part.hists.insert(make_pair(h->path(), *h));
+      }
+    }
+
+    if (first)
+      cerr << "warning: no TTTT histograms in " << fname << endl;
+
+    return part;
+  }
+
+}
+
+
+void usage(const char* prog) {
+  cerr << "usage: " << prog << " [-j nthreads] -o merged.yoda job1.yoda job2.yoda ...\n"
+    << "  -j nthreads  threads for reading and summing (default: all cores)" << endl;
+  return;
+}
+
+
+int main(int argc, char** argv) {
+  size_t nthreads = thread::hardware_concurrency();
+  string outfname;
+  vector<string> infnames;
+
+  for (int i = 1; i < argc; i++) {
+    const string arg = argv[i];
+    if (arg == "-j" && i+1 < argc) {
+      const char* val = argv[++i];
+      char* end;
+      const long j = strtol(val, &end, 10);
+      if (*val == '\0' || *end != '\0' || j < 1) {
+        cerr << "error: -j needs a positive number of threads, not '" << val << "'" << endl;
+        usage(argv[0]);
+        return 1;
+      }
+      nthreads = j;
+    } else if (arg == "-o" && i+1 < argc)
+      outfname = argv[++i];
+    else
+      infnames.push_back(arg);
+  }
+
+  if (outfname.empty() || infnames.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (nthreads == 0)
+    nthreads = 1;
+
+
+  const size_t n = infnames.size();
+  vector<Partial> parts(n);
+  vector<string> errors(n);
+
+  parallelFor(n, nthreads, [&](size_t i) {
+      try {
+        parts[i] = readJob(infnames[i]);
+      } catch (const exception& e) {
+        errors[i] = e.what();
+      }
+    });
+
+  for (const string& err : errors)
+    if (!err.empty()) {
+      cerr << "error: " << err << endl;
+      return 1;
+    }
+
+
+  // pairwise tree reduction: after the pass with stride s, parts[i] with
+  // i % 2s == 0 holds the sum of parts[i, i+2s).
+  for (size_t stride = 1; stride < n; stride *= 2) {
+    const size_t npairs = (n + 2*stride - 1) / (2*stride);
+    parallelFor(npairs, nthreads, [&](size_t p) {
+        const size_t i = 2*stride*p;
+        if (i + stride >= n)
+          return;
+
+        try {
+          parts[i] += parts[i+stride];
+        } catch (const exception& e) {
+          errors[i] = infnames[i] + " + " + infnames[i+stride] + ": " + e.what();
+        }
+        parts[i+stride] = Partial();
+      });
+
+    for (const string& err : errors)
+      if (!err.empty()) {
+        cerr << "error: " << err << endl;
+        return 1;
+      }
+  }
+
+  const Partial& total = parts[0];
+  if (total.sumw == 0) {
+    cerr << "error: total sum of weights is zero" << endl;
+    return 1;
+  }
+
+  // sum-of-weights-weighted mean of the per-job cross sections
+  const double xsec = total.xsecsumw / total.sumw;
+
+
+  // same order of operations as TTTT::finalize
+  vector<shared_ptr<Histo1D> > out;
+  for (const auto& kv : total.hists) {
+    shared_ptr<Histo1D> h = make_shared<Histo1D>(kv.second);
+    // these came from whichever job was read first; finalize writes
+    // them on the scaled histogram only.
+    h->rmAnnotation(Rivet::sumwkey);
+    h->rmAnnotation(Rivet::xseckey);
+    out.push_back(Rivet::normalisedCopy(*h));
+    Rivet::scaleToCrossSection(*h, xsec, total.sumw);
+    out.push_back(h);
+  }
+
+  WriterYODA::create().write(outfname, out);
+
+  cout << "merged " << n << " files: sumw = " << total.sumw
+    << ", cross section = " << xsec << " pb" << endl;
+
+  return 0;
+}